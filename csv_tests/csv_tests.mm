@@ -23,12 +23,54 @@
 
 #import <XCTest/XCTest.h>
 
+#include <algorithm>
+#include <atomic>
+#include <clocale>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <csv/parser.hpp>
+#include <csv/dialect.hpp>
+#include <csv/filter.hpp>
+#include <csv/parallel.hpp>
+#include <csv/pipeline.hpp>
+#include <csv/reader.hpp>
+#include <csv/push_parser.hpp>
+#include <csv/structural.hpp>
+#include <csv/writer.hpp>
 #include <csv/datasource/utf8/DataSource.hpp>
+#include <csv/datasource/codepage/DataSource.hpp>
+#include <csv/datasource/utf16/DataSource.hpp>
 #include <csv/datasource/icu/DataSource.hpp>
+#include <csv/datasource/icu/Encoding.hpp>
 
 #import <csv/objc/DSFCSVParser.h>
 
+/// A UTF-8 data source returning a string owned by the caller as a single block
+class BorrowedDataSource final: public csv::utf8::DataSource {
+public:
+	BorrowedDataSource(const std::string& data): _data(data) {}
+
+	virtual csv::block read_block() {
+		if (_read) {
+			return csv::block();
+		}
+		_read = true;
+		return csv::block(_data.data(), _data.size(), true);
+	}
+	virtual double progress_at(size_t position) const {
+		return double(position) / _data.size();
+	}
+
+private:
+	const std::string& _data;
+	bool _read = false;
+};
+
 @interface csv_tests : XCTestCase
 
 @end
@@ -79,6 +121,14 @@ std::vector<csv::record> AddRecords(const std::string& str) {
 	return records;
 }
 
+void ReplaceAll(std::string& subject, const std::string& search, const std::string& replace) {
+	size_t pos = 0;
+	while ((pos = subject.find(search, pos)) != std::string::npos) {
+		subject.replace(pos, search.length(), replace);
+		pos += replace.length();
+	}
+}
+
 - (void)testSimple {
 	std::vector<csv::record> records;
 
@@ -590,4 +640,1685 @@ std::vector<csv::record> AddRecords(const std::string& str) {
 	XCTAssertTrue(caught, @"Didn't catch file exception");
 }
 
+- (void)testStaticAndVirtualDispatchMatch {
+	const std::string text = "cat, \"do\"\"g\", fi\"sh\r\n\"whale\nshark\", pig,\r,,snork";
+
+	// Parse through the abstract interface
+	csv::utf8::StringDataSource input;
+	XCTAssertTrue(input.set(text));
+	std::vector<csv::record> virtualRecords = AddRecords(input);
+
+	// Parse through the statically bound overload
+	std::vector<csv::record> staticRecords;
+	XCTAssertTrue(input.set(text));
+	csv::parse(input, NULL, [&staticRecords](const csv::record& record, double complete) -> bool {
+		staticRecords.push_back(record);
+		return true;
+	});
+
+	XCTAssertEqual(3, virtualRecords.size());
+	XCTAssertEqual(virtualRecords.size(), staticRecords.size());
+	for (size_t row = 0; row < virtualRecords.size(); row++) {
+		XCTAssertEqual(virtualRecords[row].size(), staticRecords[row].size());
+		for (size_t column = 0; column < virtualRecords[row].size(); column++) {
+			XCTAssertEqual(virtualRecords[row][column].content, staticRecords[row][column].content);
+		}
+	}
+}
+
+- (void)testFieldsSpanningBlocks {
+	// Build some data that is much larger than the file data source's block size, with a quoted field
+	// containing line breaks and escaped quotes that spans several blocks
+	std::string longField;
+	for (size_t count = 0; count < 20000; count++) {
+		longField += "ab\r\n\"\"cd, ";
+	}
+
+	std::string text = "first, second\r\n";
+	for (size_t row = 0; row < 10; row++) {
+		text += "\"" + longField + "\", plain " + std::to_string(row) + "\n";
+	}
+
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"spanning_blocks.csv"];
+	XCTAssertTrue([[NSData dataWithBytes:text.data() length:text.size()] writeToFile:path atomically:YES]);
+
+	csv::utf8::FileDataSource input;
+	XCTAssertTrue(input.open([path fileSystemRepresentation]));
+	std::vector<csv::record> records = AddRecords(input);
+
+	XCTAssertEqual(11, records.size());
+	[self checkRowIndexes:records];
+
+	std::string expected = longField;
+	ReplaceAll(expected, "\"\"", "\"");
+	for (size_t row = 1; row < records.size(); row++) {
+		XCTAssertEqual(2, records[row].size());
+		XCTAssertEqual(expected, records[row][0].content);
+		XCTAssertEqual("plain " + std::to_string(row - 1), records[row][1].content);
+	}
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testStructuralIndex {
+	// A quoted field containing a separator and a line break, padded out to a full 64 byte block
+	std::string text = "cat,\"dog,\r\nfish\",pig\n";
+	text.resize(64, 'x');
+
+	const csv::structural::masks masks = csv::structural::classify(text.data(), ',');
+	XCTAssertEqual(masks.quote, (uint64_t(1) << 4) | (uint64_t(1) << 15));
+	XCTAssertEqual(masks.separator, (uint64_t(1) << 3) | (uint64_t(1) << 8) | (uint64_t(1) << 16));
+	XCTAssertEqual(masks.cr, uint64_t(1) << 9);
+	XCTAssertEqual(masks.lf, (uint64_t(1) << 10) | (uint64_t(1) << 20));
+
+	// Partial blocks only report the bytes requested
+	const csv::structural::masks partial = csv::structural::classify(text.data(), 5, ',');
+	XCTAssertEqual(partial.separator, uint64_t(1) << 3);
+}
+
+- (void)testParallelParse {
+	// Quoted fields containing line breaks mean that many of the chunk boundaries fall within records
+	std::string text = "id, name, notes\r\n";
+	for (size_t row = 0; row < 2000; row++) {
+		text += std::to_string(row) + ", \"name\r\n" + std::to_string(row) + "\", \"a \"\"quoted\"\"\nnote\"\n";
+		if (row % 100 == 0) {
+			text += "\n";
+		}
+	}
+
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"parallel.csv"];
+	XCTAssertTrue([[NSData dataWithBytes:text.data() length:text.size()] writeToFile:path atomically:YES]);
+
+	csv::utf8::FileDataSource input;
+	XCTAssertTrue(input.open([path fileSystemRepresentation]));
+	std::vector<csv::record> expected = AddRecords(input);
+	XCTAssertEqual(2001, expected.size());
+
+	csv::parallel_options options;
+	options.threads = 4;
+	options.chunkSize = 100;
+
+	// Ordered delivery
+	std::vector<csv::record> records;
+	XCTAssertEqual(csv::Complete, csv::parallel_parse(input, [&records](const csv::record& record, double progress) -> bool {
+		records.push_back(record);
+		return true;
+	}, options));
+
+	XCTAssertEqual(expected.size(), records.size());
+	[self checkRowIndexes:records];
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+
+	// Unordered delivery still provides the correct row numbers
+	options.ordered = false;
+	std::mutex lock;
+	std::vector<csv::record> unordered(expected.size());
+	XCTAssertEqual(csv::Complete, csv::parallel_parse(input, [&lock, &unordered](const csv::record& record, double progress) -> bool {
+		std::lock_guard<std::mutex> guard(lock);
+		unordered[record.row] = record;
+		return true;
+	}, options));
+	[self checkRowIndexes:unordered];
+	XCTAssertEqual(expected.back()[2].content, unordered.back()[2].content);
+
+	// Stopping early
+	size_t count = 0;
+	options.ordered = true;
+	XCTAssertEqual(csv::Complete, csv::parallel_parse(input, [&count](const csv::record& record, double progress) -> bool {
+		return ++count < 10;
+	}, options));
+	XCTAssertEqual(10, count);
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testRecordViews {
+	const std::string text = "cat, \"do\"\"g\", fish\n\n  \"a\r\nb\", , fi\"sh\r\n";
+	std::vector<csv::record> expected = AddRecords(text);
+	XCTAssertEqual(2, expected.size());
+
+	// The views match the records, and can be copied into records
+	csv::utf8::StringDataSource input;
+	XCTAssertTrue(input.set(text));
+	std::vector<csv::record> records;
+	bool columnsMatch = true;
+	XCTAssertEqual(csv::Complete, csv::parse(input, [&records, &columnsMatch](const csv::record_view& record, double progress) -> bool {
+		for (size_t column = 0; column < record.size(); column++) {
+			columnsMatch = columnsMatch && (record[column].row == record.row) && (record[column].column == column);
+		}
+		records.push_back(record.record());
+		return true;
+	}));
+
+	XCTAssertTrue(columnsMatch);
+	[self checkRowIndexes:records];
+	XCTAssertEqual(expected.size(), records.size());
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+	XCTAssertEqual("do\"g", records[0][1].content);
+	XCTAssertEqual("a\r\nb", records[1][0].content);
+	XCTAssertEqual("fi\"sh", records[1][2].content);
+
+	// Fields without escaped quotes refer directly to the source data, fields with escaped quotes are copied
+	const std::string data = "plain, \"quoted\", \"esc\"\"aped\"";
+	BorrowedDataSource borrowed(data);
+	std::vector<bool> referenced;
+	std::vector<std::string> content;
+	XCTAssertEqual(csv::Complete, csv::parse(borrowed, [&data, &referenced, &content](const csv::record_view& record, double progress) -> bool {
+		for (const auto& field: record.content) {
+			referenced.push_back(field.data >= data.data() && field.data < data.data() + data.size());
+			content.push_back(field.str());
+		}
+		return true;
+	}));
+
+	XCTAssertEqual(3, content.size());
+	XCTAssertEqual("plain", content[0]);
+	XCTAssertEqual("quoted", content[1]);
+	XCTAssertEqual("esc\"aped", content[2]);
+	XCTAssertTrue(referenced[0]);
+	XCTAssertTrue(referenced[1]);
+	XCTAssertFalse(referenced[2]);
+}
+- (void)testMappedFileDataSource {
+	// The mapped source skips the BOM
+	csv::utf8::MappedFileDataSource parser;
+	parser.separator = '\t';
+	NSURL* url = [self resourceWithName:@"simple_csv_utf8_bom" extension:@"tsv"];
+	XCTAssertNotNil(url);
+	XCTAssertTrue(parser.open([url fileSystemRepresentation]));
+
+	std::vector<csv::record> records = AddRecords(parser);
+	XCTAssertEqual(1, records.size());
+	XCTAssertEqual("fish", records[0][0].content);
+	XCTAssertEqual("pig", records[0][1].content);
+	XCTAssertEqual("snort", records[0][2].content);
+
+	// And produces the same records as the file source
+	url = [self resourceWithName:@"orig" extension:@"csv"];
+	XCTAssertNotNil(url);
+
+	csv::utf8::FileDataSource file;
+	XCTAssertTrue(file.open([url fileSystemRepresentation]));
+	std::vector<csv::record> expected = AddRecords(file);
+
+	XCTAssertTrue(parser.open([url fileSystemRepresentation]));
+	parser.separator = ',';
+	double finalProgress = 0;
+	records.clear();
+	csv::parse(parser, NULL, [&records, &finalProgress](const csv::record& record, double progress) -> bool {
+		records.push_back(record);
+		finalProgress = progress;
+		return true;
+	});
+
+	XCTAssertEqual(expected.size(), records.size());
+	[self checkRowIndexes:records];
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+	XCTAssertEqualWithAccuracy(1.0, finalProgress, 0.0001);
+
+	bool caught = false;
+	try {
+		csv::utf8::MappedFileDataSource input("/tmp/blah.12345");
+	}
+	catch (const csv::file_exception& e) {
+		caught = true;
+	}
+	XCTAssertTrue(caught, @"Didn't catch file exception");
+}
+- (void)testFileDataSourcePipe {
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"pipe.csv"];
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+	XCTAssertEqual(0, mkfifo([path fileSystemRepresentation], 0600));
+
+	// The BOM is removed from the start of the stream
+	const std::string text = "\xEF\xBB\xBF" "cat, dog\n\"fi\nsh\", pig\n";
+	std::string fifo([path fileSystemRepresentation]);
+	std::thread writer([&fifo, &text]() {
+		std::ofstream out(fifo.c_str(), std::ios::out | std::ios::binary);
+		out << text;
+	});
+
+	csv::utf8::FileDataSource input;
+	XCTAssertTrue(input.open(fifo.c_str()));
+	XCTAssertFalse(input.has_length());
+
+	std::vector<csv::record> records;
+	std::vector<double> progress;
+	csv::parse(input, NULL, [&records, &progress](const csv::record& record, double complete) -> bool {
+		records.push_back(record);
+		progress.push_back(complete);
+		return true;
+	});
+	writer.join();
+
+	XCTAssertEqual(2, records.size());
+	[self checkRowIndexes:records];
+	XCTAssertEqual("cat", records[0][0].content);
+	XCTAssertEqual("fi\nsh", records[1][0].content);
+	XCTAssertEqual("pig", records[1][1].content);
+
+	// Without a length, progress is 0 until the end of the pipe has been read.  The bytes read are counted instead
+	XCTAssertEqual(2, progress.size());
+	XCTAssertEqual(0.0, progress.front());
+	XCTAssertLessThanOrEqual(progress.back(), 1.0);
+	XCTAssertEqual(1.0, input.progress_at(text.size()));
+	XCTAssertEqual(text.size(), input.bytes_read());
+
+	// A pipe can't be split for parallel parsing
+	csv::parallel_options options;
+	XCTAssertEqual(csv::Error, csv::parallel_parse(input, [](const csv::record& record, double complete) -> bool {
+		return true;
+	}, options));
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+- (void)testFileDataSourceSlowPipe {
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"slow_pipe.csv"];
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+	XCTAssertEqual(0, mkfifo([path fileSystemRepresentation], 0600));
+
+	// The first record is parsed as soon as it has been written, rather than once a whole block has arrived
+	std::string fifo([path fileSystemRepresentation]);
+	std::atomic<bool> received(false);
+	bool early = false;
+	std::thread writer([&fifo, &received, &early]() {
+		std::ofstream out(fifo.c_str(), std::ios::out | std::ios::binary);
+		out << "cat, dog\n" << std::flush;
+		for (int wait = 0; wait < 500 && !received; wait++) {
+			usleep(10000);
+		}
+		early = received;
+		out << "fish, pig\n";
+	});
+
+	csv::utf8::FileDataSource input;
+	XCTAssertTrue(input.open(fifo.c_str()));
+
+	std::vector<csv::record> records;
+	std::vector<double> progress;
+	csv::parse(input, NULL, [&records, &progress, &received](const csv::record& record, double complete) -> bool {
+		records.push_back(record);
+		progress.push_back(complete);
+		received = true;
+		return true;
+	});
+	writer.join();
+
+	XCTAssertTrue(early);
+	XCTAssertEqual(2, records.size());
+	XCTAssertEqual("cat", records[0][0].content);
+	XCTAssertEqual("pig", records[1][1].content);
+
+	// The first record was parsed before the end of the pipe had been read
+	XCTAssertEqual(0.0, progress[0]);
+	XCTAssertEqual(19, input.bytes_read());
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+- (void)testReader {
+	const std::string text = "id, name\n1, cat\n\n2, \"do\"\"g\"\n3, fish";
+	std::vector<csv::record> expected = AddRecords(text);
+	XCTAssertEqual(4, expected.size());
+
+	// Iterate over all of the records
+	csv::utf8::StringDataSource input;
+	XCTAssertTrue(input.set(text));
+	csv::reader reader(input);
+	std::vector<csv::record> records;
+	for (const auto& record: reader) {
+		records.push_back(record);
+	}
+	XCTAssertEqual(expected.size(), records.size());
+	[self checkRowIndexes:records];
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+	XCTAssertFalse(reader.next());
+	XCTAssertTrue(reader.begin() == reader.end());
+
+	// Step through two sources in step with each other, joining on the first column
+	csv::utf8::StringDataSource left;
+	XCTAssertTrue(left.set("1, cat\n2, dog\n4, fish"));
+	csv::utf8::StringDataSource right;
+	XCTAssertTrue(right.set("1, meow\n3, moo\n4, blub"));
+
+	csv::view_reader leftReader(left);
+	csv::view_reader rightReader(right);
+	std::vector<std::string> joined;
+	bool moreLeft = leftReader.next();
+	bool moreRight = rightReader.next();
+	while (moreLeft && moreRight) {
+		const std::string leftKey = leftReader.record()[0].str();
+		const std::string rightKey = rightReader.record()[0].str();
+		if (leftKey == rightKey) {
+			joined.push_back(leftReader.record()[1].str() + " " + rightReader.record()[1].str());
+			moreLeft = leftReader.next();
+			moreRight = rightReader.next();
+		}
+		else if (leftKey < rightKey) {
+			moreLeft = leftReader.next();
+		}
+		else {
+			moreRight = rightReader.next();
+		}
+	}
+
+	XCTAssertEqual(2, joined.size());
+	XCTAssertEqual("cat meow", joined[0]);
+	XCTAssertEqual("fish blub", joined[1]);
+}
+
+- (void)testPushParser {
+	const std::string text = "\xEF\xBB\xBFid, name\r\n1, \"c\r\nat\"\r\n\r\n2, \"do\"\"g\"\r\n3, fish";
+	std::vector<csv::record> expected = AddRecords(text);
+	XCTAssertEqual(4, expected.size());
+
+	// Send the data through a socket in small packets, feeding the parser as each packet arrives
+	int sockets[2];
+	XCTAssertEqual(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+	std::thread writer([&text, &sockets]() {
+		for (size_t offset = 0; offset < text.size(); offset += 3) {
+			const size_t count = std::min<size_t>(3, text.size() - offset);
+			if (write(sockets[1], text.data() + offset, count) != static_cast<ssize_t>(count)) {
+				break;
+			}
+		}
+		close(sockets[1]);
+	});
+
+	std::vector<csv::record> records;
+	csv::push_parser parser([&records](const csv::record& record, double progress) -> bool {
+		records.push_back(record);
+		return true;
+	});
+
+	char packet[5];
+	ssize_t count;
+	while ((count = read(sockets[0], packet, sizeof(packet))) > 0) {
+		XCTAssertTrue(parser.feed(packet, count));
+	}
+	close(sockets[0]);
+	writer.join();
+	XCTAssertEqual(csv::State::Complete, parser.finish());
+
+	XCTAssertEqual(expected.size(), records.size());
+	[self checkRowIndexes:records];
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+
+	// Records are delivered as soon as they are complete
+	records.clear();
+	csv::push_parser tabbed([&records](const csv::record& record, double progress) -> bool {
+		records.push_back(record);
+		return records.size() < 2;
+	});
+	tabbed.separator = '\t';
+	XCTAssertTrue(tabbed.feed("a\tb\nc", 5));
+	XCTAssertEqual(1, records.size());
+
+	// The record callback returns false for the second record, so the remaining data is ignored
+	XCTAssertFalse(tabbed.feed("\td\ne", 5));
+	XCTAssertEqual(2, records.size());
+	XCTAssertEqual("d", records[1][1].content);
+	XCTAssertFalse(tabbed.feed("\tf\n", 3));
+	XCTAssertEqual(csv::State::Complete, tabbed.finish());
+	XCTAssertEqual(2, records.size());
+}
+
+- (void)testDialect {
+	const std::string text = "id\tname\n% A comment\n1\t\"c\tat\"\n\n2\t \"do\"\"g\"\n3\tfish";
+	csv::utf8::StringDataSource input;
+	XCTAssertTrue(input.set(text));
+	input.separator = '\t';
+	input.comment = '%';
+	std::vector<csv::record> expected = AddRecords(input);
+	XCTAssertEqual(4, expected.size());
+
+	// A fixed dialect produces the same records as the equivalent runtime settings
+	typedef csv::dialect<'\t', '\"', '%'> tsv_with_comments;
+	std::vector<csv::record> records;
+	XCTAssertTrue(input.set(text));
+	XCTAssertEqual(csv::State::Complete, csv::parse<tsv_with_comments>(input, nullptr, [&records](const csv::record& record, double progress) -> bool {
+		records.push_back(record);
+		return true;
+	}));
+	XCTAssertEqual(expected.size(), records.size());
+	[self checkRowIndexes:records];
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+
+	// A different quote character, returning record views
+	std::vector<std::string> names;
+	XCTAssertTrue(input.set("1,'cat, dog'\n2,'fish''n''chips'\n3,\"whale\""));
+	typedef csv::dialect<',', '\''> single_quoted;
+	XCTAssertEqual(csv::State::Complete, csv::parse<single_quoted>(input, [&names](const csv::record_view& record, double progress) -> bool {
+		names.push_back(record[1].str());
+		return true;
+	}));
+	XCTAssertEqual(3, names.size());
+	XCTAssertEqual("cat, dog", names[0]);
+	XCTAssertEqual("fish'n'chips", names[1]);
+	XCTAssertEqual("\"whale\"", names[2]);
+}
+
+- (void)testTranscodingFileDataSource {
+	NSURL* url = [self resourceWithName:@"korean" extension:@"csv"];
+	XCTAssertNotNil(url);
+
+	csv::icu::FileDataSource input;
+	XCTAssertTrue(input.open([url fileSystemRepresentation], "EUC-KR"));
+	std::vector<csv::record> expected = AddRecords(input);
+	XCTAssertLessThan(1000, expected.size());
+
+	// Converting the file to UTF-8 a block at a time produces the same records
+	csv::icu::TranscodingFileDataSource transcoded;
+	XCTAssertTrue(transcoded.open([url fileSystemRepresentation], NULL));
+	std::vector<csv::record> records;
+	double progress = 0.0;
+	csv::parse(transcoded, NULL, [&records, &progress](const csv::record& record, double complete) -> bool {
+		records.push_back(record);
+		progress = complete;
+		return true;
+	});
+	XCTAssertEqual(expected.size(), records.size());
+	[self checkRowIndexes:records];
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+	XCTAssertEqualWithAccuracy(1.0, progress, 0.001);
+
+	// The byte order mark is removed
+	NSURL* bomURL = [self resourceWithName:@"simple_csv_utf8_bom" extension:@"tsv"];
+	XCTAssertNotNil(bomURL);
+	XCTAssertTrue(transcoded.open([bomURL fileSystemRepresentation], "UTF-8"));
+	transcoded.separator = '\t';
+	records = AddRecords(transcoded);
+	XCTAssertEqual(1, records.size());
+	XCTAssertEqual(3, records[0].size());
+	XCTAssertEqual("fish", records[0][0].content);
+
+	// Unknown codepage
+	XCTAssertFalse(transcoded.open([url fileSystemRepresentation], "asdf"));
+}
+
+- (void)testTranscodingStringDataSource {
+	NSURL* url = [self resourceWithName:@"korean" extension:@"csv"];
+	XCTAssertNotNil(url);
+	NSData* data = [NSData dataWithContentsOfURL:url];
+	std::string text(static_cast<const char*>([data bytes]), [data length]);
+
+	csv::icu::TranscodingFileDataSource file;
+	XCTAssertTrue(file.open([url fileSystemRepresentation], "EUC-KR"));
+	std::vector<csv::record> expected = AddRecords(file);
+	XCTAssertLessThan(1000, expected.size());
+
+	// Converting the string a block at a time produces the same records as the file.  The codepage is detected
+	// from the string
+	csv::icu::TranscodingStringDataSource input;
+	XCTAssertTrue(input.set(text, NULL));
+	std::vector<csv::record> records;
+	double progress = 0.0;
+	csv::parse(input, NULL, [&records, &progress](const csv::record& record, double complete) -> bool {
+		records.push_back(record);
+		progress = complete;
+		return true;
+	});
+	XCTAssertEqual(expected.size(), records.size());
+	[self checkRowIndexes:records];
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+	XCTAssertEqualWithAccuracy(1.0, progress, 0.001);
+
+	// The string can be moved into the data source rather than copied
+	XCTAssertTrue(input.set(std::move(text), "EUC-KR"));
+	records = AddRecords(input);
+	XCTAssertEqual(expected.size(), records.size());
+	XCTAssertEqual(expected.back()[0].content, records.back()[0].content);
+
+	// The byte order mark is removed
+	input.separator = '\t';
+	XCTAssertTrue(input.set("\xEF\xBB\xBF" "fish\tdog\tcat\n", "UTF-8"));
+	records = AddRecords(input);
+	XCTAssertEqual(1, records.size());
+	XCTAssertEqual(3, records[0].size());
+	XCTAssertEqual("fish", records[0][0].content);
+
+	// Empty string
+	XCTAssertTrue(input.set("", "EUC-KR"));
+	XCTAssertEqual(0, AddRecords(input).size());
+
+	// Unknown codepage
+	XCTAssertFalse(input.set("cat, dog", "asdf"));
+	XCTAssertThrows(csv::icu::TranscodingStringDataSource("cat, dog", "asdf"));
+}
+
+- (void)testPipelinedParse {
+	std::string text;
+	for (size_t row = 0; row < 5000; row++) {
+		text += std::to_string(row) + ", \"cat\r\n" + std::to_string(row) + "\", dog\n";
+	}
+	std::vector<csv::record> expected = AddRecords(text);
+	XCTAssertEqual(5000, expected.size());
+
+	// Small buffers and batches, so that the threads regularly wait for each other
+	csv::pipeline_options options;
+	options.bufferSize = 1000;
+	options.buffers = 3;
+	options.batchSize = 7;
+
+	// Reading on a background thread
+	csv::utf8::StringDataSource input;
+	XCTAssertTrue(input.set(text));
+	std::vector<csv::record> records;
+	{
+		csv::utf8::PipelinedDataSource pipelined(input, options);
+		records = AddRecords(pipelined);
+	}
+	XCTAssertEqual(expected.size(), records.size());
+	[self checkRowIndexes:records];
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+
+	// Reading, parsing and handling the records on separate threads
+	records.clear();
+	std::vector<double> progress;
+	XCTAssertTrue(input.set(text));
+	csv::State state = csv::pipelined_parse(input, [&records, &progress](const csv::record& record, double complete) -> bool {
+		records.push_back(record);
+		progress.push_back(complete);
+		return true;
+	}, options);
+	XCTAssertEqual(csv::State::Complete, state);
+	XCTAssertEqual(expected.size(), records.size());
+	[self checkRowIndexes:records];
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row][1].content, records[row][1].content);
+	}
+	XCTAssertTrue(std::is_sorted(progress.begin(), progress.end()));
+	XCTAssertEqualWithAccuracy(1.0, progress.back(), 0.001);
+
+	// Stopping early
+	records.clear();
+	XCTAssertTrue(input.set(text));
+	state = csv::pipelined_parse(input, [&records](const csv::record& record, double complete) -> bool {
+		records.push_back(record);
+		return records.size() < 10;
+	}, options);
+	XCTAssertEqual(csv::State::Complete, state);
+	XCTAssertEqual(10, records.size());
+
+	// Cancelling
+	size_t count = 0;
+	XCTAssertTrue(input.set(text));
+	state = csv::pipelined_parse(input, [&input, &count](const csv::record& record, double complete) -> bool {
+		input.cancelled = (++count == 20);
+		return true;
+	}, options);
+	XCTAssertEqual(csv::State::Cancelled, state);
+	XCTAssertEqual(20, count);
+}
+
+- (void)testOpenFile {
+	// Files in other codepages are converted
+	NSURL* url = [self resourceWithName:@"korean" extension:@"csv"];
+	XCTAssertNotNil(url);
+	std::unique_ptr<csv::utf8::DataSource> input = csv::icu::open_file([url fileSystemRepresentation], NULL);
+	XCTAssertTrue(input != nullptr);
+	XCTAssertTrue(dynamic_cast<csv::icu::TranscodingFileDataSource*>(input.get()) != NULL);
+
+	csv::icu::FileDataSource icuInput;
+	XCTAssertTrue(icuInput.open([url fileSystemRepresentation], NULL));
+	std::vector<csv::record> expected = AddRecords(icuInput);
+	std::vector<csv::record> records = AddRecords(*input);
+	XCTAssertEqual(expected.size(), records.size());
+	XCTAssertEqual(expected.back()[0].content, records.back()[0].content);
+
+	// UTF-8 files are parsed directly
+	url = [self resourceWithName:@"orig" extension:@"csv"];
+	XCTAssertNotNil(url);
+	input = csv::icu::open_file([url fileSystemRepresentation], NULL);
+	XCTAssertTrue(dynamic_cast<csv::utf8::MappedFileDataSource*>(input.get()) != NULL);
+	XCTAssertTrue(icuInput.open([url fileSystemRepresentation], NULL));
+	expected = AddRecords(icuInput);
+	records = AddRecords(*input);
+	XCTAssertEqual(expected.size(), records.size());
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+
+	// Single byte codepages are decoded by the built-in tables, which pass ASCII through
+	const std::string text = "cat, dog\nfish, \"whale\"\n";
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"ascii.csv"];
+	XCTAssertTrue([[NSData dataWithBytes:text.data() length:text.size()] writeToFile:path atomically:YES]);
+	input = csv::icu::open_file([path fileSystemRepresentation], "ISO-8859-1");
+	XCTAssertTrue(dynamic_cast<csv::codepage::FileDataSource*>(input.get()) != NULL);
+	records = AddRecords(*input);
+	XCTAssertEqual(2, records.size());
+	XCTAssertEqual("whale", records[1][1].content);
+
+	input = csv::icu::open_file([path fileSystemRepresentation], "UTF-16LE");
+	XCTAssertTrue(dynamic_cast<csv::utf16::FileDataSource*>(input.get()) != NULL);
+
+	// Including any characters beyond ASCII, wherever they are in the file
+	const std::string latin1 = "caf\xE9, dog\n";
+	XCTAssertTrue([[NSData dataWithBytes:latin1.data() length:latin1.size()] writeToFile:path atomically:YES]);
+	input = csv::icu::open_file([path fileSystemRepresentation], "ISO-8859-1");
+	XCTAssertTrue(dynamic_cast<csv::codepage::FileDataSource*>(input.get()) != NULL);
+	records = AddRecords(*input);
+	XCTAssertEqual(1, records.size());
+	XCTAssertEqual("caf\xC3\xA9", records[0][0].content);
+
+	// A UTF-8 file isn't checked before it's parsed.  Its invalid sequences are replaced as it's parsed instead, as
+	// converting it would replace them
+	std::string invalid;
+	for (int row = 0; row < 1000; row++) {
+		invalid += (row == 700) ? "bad \xFF byte, \xE4\xB8\n" : "caf\xC3\xA9, \xE4\xB8\xAD\n";
+	}
+	XCTAssertTrue([[NSData dataWithBytes:invalid.data() length:invalid.size()] writeToFile:path atomically:YES]);
+	input = csv::icu::open_file([path fileSystemRepresentation], "UTF-8");
+	XCTAssertTrue(dynamic_cast<csv::utf8::MappedFileDataSource*>(input.get()) != NULL);
+	XCTAssertEqual(csv::utf8::validation::Replace, input ? input->validate : csv::utf8::validation::Unchecked);
+	records = input ? AddRecords(*input) : std::vector<csv::record>();
+
+	csv::icu::TranscodingFileDataSource transcoded;
+	XCTAssertTrue(transcoded.open([path fileSystemRepresentation], "UTF-8"));
+	expected = AddRecords(transcoded);
+	XCTAssertEqual(1000, records.size());
+	XCTAssertEqual(expected.size(), records.size());
+	for (size_t row = 0; row < std::min(expected.size(), records.size()); row++) {
+		XCTAssertEqual(expected[row][0].content, records[row][0].content);
+		XCTAssertEqual(expected[row][1].content, records[row][1].content);
+	}
+	XCTAssertEqual("bad \xEF\xBF\xBD byte", records[700][0].content);
+	XCTAssertEqual(700, input ? input->invalid.row : 0);
+
+	XCTAssertTrue(csv::icu::open_file([path fileSystemRepresentation], "asdf") == nullptr);
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testOpenPipe {
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"open_pipe.csv"];
+	std::string fifo([path fileSystemRepresentation]);
+
+	// Write the text to a new pipe on another thread while it's read
+	std::thread writer;
+	auto startPipe = [&fifo, &writer](const std::string& text) -> bool {
+		::unlink(fifo.c_str());
+		if (mkfifo(fifo.c_str(), 0600) != 0) {
+			return false;
+		}
+		writer = std::thread([&fifo, text]() {
+			std::ofstream out(fifo.c_str(), std::ios::out | std::ios::binary);
+			out << text;
+		});
+		return true;
+	};
+
+	// The start of a stream can be read ahead without losing it
+	XCTAssertTrue(startPipe("\xEF\xBB\xBF" "cat, dog\nfish, pig\n"));
+	csv::utf8::FileDataSource stream;
+	XCTAssertTrue(stream.open(fifo.c_str()));
+	const csv::block start = stream.peek(4);
+	XCTAssertEqual("\xEF\xBB\xBF" "c", std::string(start.data, start.size));
+	std::vector<csv::record> records = AddRecords(stream);
+	writer.join();
+	XCTAssertEqual(2, records.size());
+	XCTAssertEqual("cat", records[0][0].content);
+	XCTAssertEqual("pig", records[1][1].content);
+	XCTAssertTrue(stream.peek(4).size == 0);
+
+	// A pipe is only opened once, and its codepage is detected from the start of the data that is then parsed
+	std::string text;
+	for (int index = 0; index < 20; index++) {
+		text += "Jos\xC3\xA9, Z\xC3\xBCrich\n";
+	}
+	XCTAssertTrue(startPipe(text));
+	std::unique_ptr<csv::utf8::DataSource> input = csv::icu::open_file(fifo.c_str(), NULL);
+	XCTAssertTrue(dynamic_cast<csv::utf8::FileDataSource*>(input.get()) != NULL);
+	records = input ? AddRecords(*input) : std::vector<csv::record>();
+	writer.join();
+	XCTAssertEqual(20, records.size());
+	XCTAssertEqual("Jos\xC3\xA9", records[0][0].content);
+
+	// UTF-16, skipping its byte order mark
+	const std::string ascii = "cat, dog\nfish, pig\n";
+	text = "\xFF\xFE";
+	for (char ch: ascii) {
+		text += ch;
+		text += '\0';
+	}
+	XCTAssertTrue(startPipe(text));
+	input = csv::icu::open_file(fifo.c_str(), NULL);
+	XCTAssertTrue(dynamic_cast<csv::utf16::FileDataSource*>(input.get()) != NULL);
+	records = input ? AddRecords(*input) : std::vector<csv::record>();
+	writer.join();
+	XCTAssertEqual(2, records.size());
+	XCTAssertEqual("cat", records[0][0].content);
+	XCTAssertEqual("pig", records[1][1].content);
+	XCTAssertEqual(1.0, input ? input->progress() : 0.0);
+
+	// Other codepages are converted
+	text.clear();
+	for (int index = 0; index < 20; index++) {
+		text += "caf\xE9, cr\xE8me br\xFBl\xE9" "e\n";
+	}
+	XCTAssertTrue(startPipe(text));
+	input = csv::icu::open_file(fifo.c_str(), NULL);
+	XCTAssertTrue(dynamic_cast<csv::icu::TranscodingFileDataSource*>(input.get()) != NULL);
+	records = input ? AddRecords(*input) : std::vector<csv::record>();
+	writer.join();
+	XCTAssertEqual(20, records.size());
+	XCTAssertEqual("caf\xC3\xA9", records[0][0].content);
+
+	XCTAssertTrue(startPipe(text));
+	csv::icu::TranscodingFileDataSource transcoded;
+	XCTAssertTrue(transcoded.open(fifo.c_str(), "ISO-8859-1"));
+	records = AddRecords(transcoded);
+	writer.join();
+	XCTAssertEqual(20, records.size());
+	XCTAssertEqual("cr\xC3\xA8me br\xC3\xBBl\xC3\xA9" "e", records[19][1].content);
+
+	::unlink(fifo.c_str());
+}
+
+- (void)testCodepageDecoding {
+	XCTAssertTrue(csv::codepage::find("windows-1252") != NULL);
+	XCTAssertTrue(csv::codepage::find("CP1252") == csv::codepage::find("windows-1252"));
+	XCTAssertTrue(csv::codepage::find("latin1") == csv::codepage::find("iso_8859-1"));
+	XCTAssertTrue(csv::codepage::find("EUC-KR") == NULL);
+	XCTAssertTrue(csv::codepage::find(NULL) == NULL);
+
+	// Every byte decodes to the same characters as ICU
+	std::string bytes;
+	for (size_t ch = 1; ch < 256; ch++) {
+		bytes += static_cast<char>(ch);
+	}
+	const char* codepages[] = { "ISO-8859-1", "ISO-8859-2", "ISO-8859-5", "ISO-8859-7", "ISO-8859-9", "ISO-8859-15",
+								"windows-1250", "windows-1251", "windows-1252", "windows-1253", "windows-1254", "KOI8-R" };
+	for (const char* name: codepages) {
+		const csv::codepage::table* decoder = csv::codepage::find(name);
+		XCTAssertTrue(decoder != NULL);
+		std::vector<char> decoded(bytes.size() * csv::codepage::table::MAX_EXPANSION);
+		decoded.resize(decoder->decode(bytes.data(), bytes.size(), decoded.data()));
+
+		std::string expected;
+		U_ICU_NAMESPACE::UnicodeString(bytes.data(), (int32_t)bytes.size(), name).toUTF8String(expected);
+		XCTAssertEqual(expected, std::string(decoded.data(), decoded.size()));
+	}
+
+	// windows-1252 text containing characters outside ISO-8859-1
+	const std::string text = "name, price\n\"caf\xE9\", \x80\x31\n\x93quoted\x94, na\xEFve\n";
+	csv::codepage::StringDataSource input;
+	XCTAssertFalse(input.set(text, "not-a-codepage"));
+	XCTAssertTrue(input.set(text, "windows-1252"));
+	std::vector<csv::record> expected = AddRecords(input);
+	XCTAssertEqual(3, expected.size());
+	XCTAssertEqual("caf\xC3\xA9", expected[1][0].content);
+	XCTAssertEqual("\xE2\x82\xAC" "1", expected[1][1].content);
+	XCTAssertEqual("\xE2\x80\x9Cquoted\xE2\x80\x9D", expected[2][0].content);
+	XCTAssertEqual("na\xC3\xAFve", expected[2][1].content);
+
+	// Files are decoded a block at a time, and can be decoded by the parallel parser's workers
+	std::string contents;
+	for (size_t row = 0; row < 2000; row++) {
+		contents += text;
+	}
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"windows1252.csv"];
+	XCTAssertTrue([[NSData dataWithBytes:contents.data() length:contents.size()] writeToFile:path atomically:YES]);
+
+	XCTAssertTrue(input.set(contents, "windows-1252"));
+	expected = AddRecords(input);
+	XCTAssertEqual(6000, expected.size());
+
+	csv::codepage::FileDataSource file;
+	XCTAssertFalse(file.open([path fileSystemRepresentation], "not-a-codepage"));
+	XCTAssertTrue(file.open([path fileSystemRepresentation], "windows-1252"));
+	std::vector<csv::record> records = AddRecords(file);
+	XCTAssertEqual(expected.size(), records.size());
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+
+	csv::utf8::FileDataSource raw;
+	XCTAssertTrue(raw.open([path fileSystemRepresentation]));
+	csv::parallel_options options;
+	options.threads = 4;
+	options.chunkSize = 1000;
+	options.codepage = csv::codepage::find("windows-1252");
+	records.clear();
+	XCTAssertEqual(csv::Complete, csv::parallel_parse(raw, [&records](const csv::record& record, double progress) -> bool {
+		records.push_back(record);
+		return true;
+	}, options));
+	XCTAssertEqual(expected.size(), records.size());
+	[self checkRowIndexes:records];
+	for (size_t row = 0; row < records.size(); row++) {
+		XCTAssertEqual(expected[row].size(), records[row].size());
+		for (size_t column = 0; column < records[row].size(); column++) {
+			XCTAssertEqual(expected[row][column].content, records[row][column].content);
+		}
+	}
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testUTF16FileDataSource {
+	const std::string text = "name, notes\r\n\"caf\xC3\xA9\", \"multi\r\nline\"\r\n\xF0\x9F\x87\xAE\xF0\x9F\x87\xAA, \xE2\x82\xAC" "100\r\n";
+	std::vector<csv::record> expected = AddRecords(text);
+	XCTAssertEqual(3, expected.size());
+
+	NSString* string = [NSString stringWithUTF8String:text.c_str()];
+	NSData* littleEndian = [string dataUsingEncoding:NSUTF16LittleEndianStringEncoding];
+	NSData* bigEndian = [string dataUsingEncoding:NSUTF16BigEndianStringEncoding];
+	std::string contents[3];
+	contents[0] = "\xFF\xFE" + std::string((const char*)[littleEndian bytes], [littleEndian length]);
+	contents[1] = "\xFE\xFF" + std::string((const char*)[bigEndian bytes], [bigEndian length]);
+	contents[2] = std::string((const char*)[littleEndian bytes], [littleEndian length]);
+	const csv::utf16::ByteOrder orders[3] = { csv::utf16::LittleEndian, csv::utf16::BigEndian, csv::utf16::LittleEndian };
+
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"utf16.csv"];
+	for (size_t index = 0; index < 3; index++) {
+		XCTAssertTrue([[NSData dataWithBytes:contents[index].data() length:contents[index].size()] writeToFile:path atomically:YES]);
+
+		// The byte order mark determines the byte order (the byte order passed to open() is only used without one)
+		csv::utf16::FileDataSource input;
+		XCTAssertTrue(input.open([path fileSystemRepresentation], index == 2 ? csv::utf16::LittleEndian : csv::utf16::BigEndian));
+		XCTAssertEqual(orders[index], input.order());
+		XCTAssertEqual(index < 2, input.has_bom());
+
+		std::vector<csv::record> records = AddRecords(input);
+		XCTAssertEqual(expected.size(), records.size());
+		for (size_t row = 0; row < records.size(); row++) {
+			XCTAssertEqual(expected[row].size(), records[row].size());
+			for (size_t column = 0; column < records[row].size(); column++) {
+				XCTAssertEqual(expected[row][column].content, records[row][column].content);
+			}
+		}
+	}
+
+	// Characters split between blocks, and unpaired surrogates
+	csv::utf16::decoder decoder(csv::utf16::LittleEndian);
+	const std::string units = std::string("a\0\x3D\xD8\x00\xDE\x00\xDC" "b\0\x3D\xD8", 12);
+	std::string decoded;
+	char buffer[64];
+	for (size_t index = 0; index < units.size(); index++) {
+		decoded.append(buffer, decoder.decode(units.data() + index, 1, buffer, index + 1 == units.size()));
+	}
+	XCTAssertEqual("a\xF0\x9F\x98\x80\xEF\xBF\xBD" "b\xEF\xBF\xBD", decoded);
+
+	// UTF-16 files are decoded without ICU
+	XCTAssertTrue([[NSData dataWithBytes:contents[0].data() length:contents[0].size()] writeToFile:path atomically:YES]);
+	std::unique_ptr<csv::utf8::DataSource> input = csv::icu::open_file([path fileSystemRepresentation], "UTF-16");
+	XCTAssertTrue(dynamic_cast<csv::utf16::FileDataSource*>(input.get()) != NULL);
+	std::vector<csv::record> records = AddRecords(*input);
+	XCTAssertEqual(expected.size(), records.size());
+	XCTAssertEqual(expected[2][1].content, records[2][1].content);
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testUTF8Validation {
+	const std::string text = "id, name\n1, caf\xC3\xA9\n2, b\xFF" "d\n3, fish\n";
+	const size_t offset = text.find('\xFF');
+
+	// By default the data isn't validated
+	csv::utf8::StringDataSource input;
+	XCTAssertTrue(input.set(text));
+	XCTAssertEqual(csv::utf8::validation::Unchecked, input.validate);
+	std::vector<csv::record> records = AddRecords(input);
+	XCTAssertEqual(4, records.size());
+	XCTAssertEqual("b\xFF" "d", records[2][1].content);
+	XCTAssertFalse(input.invalid.found);
+
+	// Report the invalid sequence, but leave the data unchanged
+	XCTAssertTrue(input.set(text));
+	input.validate = csv::utf8::validation::PassThrough;
+	records = AddRecords(input);
+	XCTAssertEqual(4, records.size());
+	XCTAssertEqual("b\xFF" "d", records[2][1].content);
+	XCTAssertTrue(input.invalid.found);
+	XCTAssertEqual(offset, input.invalid.offset);
+	XCTAssertEqual(2, input.invalid.row);
+	XCTAssertEqual(1, input.invalid.column);
+
+	// Replace the invalid sequence
+	XCTAssertTrue(input.set(text));
+	input.validate = csv::utf8::validation::Replace;
+	records = AddRecords(input);
+	XCTAssertEqual(4, records.size());
+	XCTAssertEqual("b\xEF\xBF\xBD" "d", records[2][1].content);
+	XCTAssertEqual("fish", records[3][1].content);
+	XCTAssertTrue(input.invalid.found);
+	XCTAssertEqual(offset, input.invalid.offset);
+
+	// Stop at the invalid sequence.  Only the records before it are returned
+	XCTAssertTrue(input.set(text));
+	input.validate = csv::utf8::validation::Fail;
+	records.clear();
+	XCTAssertEqual(csv::Error, csv::parse(input, nullptr, [&records](const csv::record& record, double progress) -> bool {
+		records.push_back(record);
+		return true;
+	}));
+	XCTAssertEqual(2, records.size());
+	XCTAssertTrue(input.failed());
+	XCTAssertEqual(offset, input.invalid.offset);
+	XCTAssertEqual(2, input.invalid.row);
+	XCTAssertEqual(1, input.invalid.column);
+
+	// Sequences are validated across the blocks read from a file
+	std::string contents;
+	for (size_t row = 0; row < 100000; row++) {
+		contents += (row == 70000) ? "caf\xC3\xA9, \xE4\xB8\n" : "caf\xC3\xA9, \xE4\xB8\xAD\n";
+	}
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"validation.csv"];
+	XCTAssertTrue([[NSData dataWithBytes:contents.data() length:contents.size()] writeToFile:path atomically:YES]);
+
+	csv::utf8::FileDataSource file;
+	XCTAssertTrue(file.open([path fileSystemRepresentation]));
+	file.validate = csv::utf8::validation::Fail;
+	size_t count = 0;
+	XCTAssertEqual(csv::Error, csv::parse(file, [&count](const csv::record_view& record, double progress) -> bool {
+		count++;
+		return true;
+	}));
+	XCTAssertEqual(70000, count);
+	XCTAssertEqual(70000 * 11 + 7, file.invalid.offset);
+	XCTAssertEqual(70000, file.invalid.row);
+	XCTAssertEqual(1, file.invalid.column);
+
+	XCTAssertTrue(file.open([path fileSystemRepresentation]));
+	file.validate = csv::utf8::validation::Replace;
+	records = AddRecords(file);
+	XCTAssertEqual(100000, records.size());
+	XCTAssertEqual("\xEF\xBF\xBD", records[70000][1].content);
+	XCTAssertEqual("\xE4\xB8\xAD", records[99999][1].content);
+	XCTAssertEqual(70000, file.invalid.row);
+
+	// The sequences split between blocks are joined again, and only the invalid one is replaced
+	size_t replaced = 0;
+	for (const auto& record: records) {
+		if (record[0].content != "caf\xC3\xA9" || record[1].content != "\xE4\xB8\xAD") {
+			replaced++;
+		}
+	}
+	XCTAssertEqual(1, replaced);
+
+	// Each chunk parsed in parallel is validated in the same way
+	csv::parallel_options options;
+	options.threads = 4;
+	options.chunkSize = 64 * 1024;
+	std::vector<csv::record> parallel;
+	XCTAssertTrue(file.open([path fileSystemRepresentation]));
+	XCTAssertEqual(csv::Complete, csv::parallel_parse(file, [&parallel](const csv::record& record, double progress) -> bool {
+		parallel.push_back(record);
+		return true;
+	}, options));
+	XCTAssertEqual(100000, parallel.size());
+	XCTAssertEqual("\xEF\xBF\xBD", parallel[70000][1].content);
+	XCTAssertEqual("\xE4\xB8\xAD", parallel[70001][1].content);
+	XCTAssertTrue(file.invalid.found);
+	XCTAssertEqual(70000 * 11 + 7, file.invalid.offset);
+	XCTAssertEqual(70000, file.invalid.row);
+	XCTAssertEqual(1, file.invalid.column);
+
+	XCTAssertTrue(file.open([path fileSystemRepresentation]));
+	file.validate = csv::utf8::validation::Fail;
+	for (const bool ordered: { true, false }) {
+		options.ordered = ordered;
+		std::atomic<size_t> delivered(0);
+		XCTAssertEqual(csv::Error, csv::parallel_parse(file, [&delivered](const csv::record& record, double progress) -> bool {
+			delivered++;
+			return true;
+		}, options));
+		XCTAssertEqual(70000, delivered.load());
+		XCTAssertEqual(70000, file.invalid.row);
+		file.invalid = csv::utf8::validation::location();
+	}
+
+	// As is the data pushed into a push parser, however it is split
+	for (const size_t piece: { 1, 1000 }) {
+		count = 0;
+		std::string last;
+		csv::push_parser pushed([&count, &last](const csv::record& record, double progress) -> bool {
+			count++;
+			last = record[1].content;
+			return true;
+		});
+		pushed.validate = (piece == 1) ? csv::utf8::validation::Replace : csv::utf8::validation::Fail;
+		for (size_t offset = 0; offset < contents.size(); offset += piece) {
+			pushed.feed(contents.data() + offset, std::min(piece, contents.size() - offset));
+		}
+		if (piece == 1) {
+			XCTAssertEqual(csv::Complete, pushed.finish());
+			XCTAssertEqual(100000, count);
+			XCTAssertEqual("\xE4\xB8\xAD", last);
+		}
+		else {
+			XCTAssertEqual(csv::Error, pushed.finish());
+			XCTAssertEqual(70000, count);
+		}
+		XCTAssertTrue(pushed.invalid.found);
+		XCTAssertEqual(70000 * 11 + 7, pushed.invalid.offset);
+		XCTAssertEqual(70000, pushed.invalid.row);
+		XCTAssertEqual(1, pushed.invalid.column);
+	}
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testEncodingDetection {
+	NSURL* url = [self resourceWithName:@"korean-small" extension:@"csv"];
+	XCTAssertNotNil(url);
+	NSData* korean = [NSData dataWithContentsOfURL:url];
+
+	// An ASCII header longer than the first sample, followed by Korean text
+	NSMutableData* data = [NSMutableData data];
+	for (int row = 0; row < 600; row++) {
+		NSString* line = [NSString stringWithFormat:@"%d, value, 12345\n", row];
+		[data appendData:[line dataUsingEncoding:NSASCIIStringEncoding]];
+	}
+	for (int copy = 0; copy < 4; copy++) {
+		[data appendData:korean];
+	}
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"mixed.csv"];
+	XCTAssertTrue([data writeToFile:path atomically:YES]);
+
+	// The start of the file alone doesn't contain any Korean
+	const auto head = csv::icu::encoding::TextEncodingForData(static_cast<const char*>([data bytes]), 4096);
+	XCTAssertNotEqual("EUC-KR", head.name);
+
+	// Whereas the middle and end of it do
+	const auto detected = csv::icu::encoding::CandidatesForFile([path fileSystemRepresentation]);
+	XCTAssertFalse(detected.invalid());
+	XCTAssertEqual("EUC-KR", detected.best().name);
+	XCTAssertEqual(detected.best().confidence, detected.confidence("EUC-KR"));
+	XCTAssertTrue(detected.candidates.size() > 1);
+	for (size_t index = 1; index < detected.candidates.size(); index++) {
+		XCTAssertTrue(detected.candidates[index - 1].confidence >= detected.candidates[index].confidence);
+	}
+	XCTAssertTrue(detected.confidence("UTF-16LE") < detected.confidence("EUC-KR"));
+	XCTAssertEqual(0, detected.confidence("no-such-encoding"));
+
+	// The detector is reused on each thread
+	std::string name;
+	std::thread other([&path, &name]() {
+		name = csv::icu::encoding::TextEncodingForFile([path fileSystemRepresentation]).name;
+	});
+	other.join();
+	XCTAssertEqual("EUC-KR", name);
+
+	// Files that don't exist (or are empty) aren't detected
+	XCTAssertTrue(csv::icu::encoding::CandidatesForFile("/nonexistent/file.csv").invalid());
+	XCTAssertTrue(csv::icu::encoding::TextEncodingForData("", 0).invalid());
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testParallelDecoding {
+	std::string text;
+	for (size_t row = 0; row < 2000; row++) {
+		text += std::to_string(row) + ", \"caf\xC3\xA9\r\n\xF0\x9F\x98\x80\", \xE2\x82\xAC" "100\r\n";
+	}
+	std::vector<csv::record> expected = AddRecords(text);
+	XCTAssertEqual(2000, expected.size());
+
+	// Parses the file in parallel, comparing the records with those expected
+	auto parseParallel = [&expected](const char* path, const char* encoding) -> csv::State {
+		csv::utf8::FileDataSource raw;
+		if (!raw.open(path)) {
+			return csv::Error;
+		}
+		csv::parallel_options options;
+		options.threads = 4;
+		options.chunkSize = 1000;
+		options.encoding = encoding;
+		std::vector<csv::record> records;
+		const csv::State state = csv::parallel_parse(raw, [&records](const csv::record& record, double progress) -> bool {
+			records.push_back(record);
+			return true;
+		}, options);
+		if (state == csv::Complete) {
+			XCTAssertEqual(expected.size(), records.size());
+			for (size_t row = 0; row < std::min(expected.size(), records.size()); row++) {
+				XCTAssertEqual(row, records[row].row);
+				XCTAssertEqual(expected[row].size(), records[row].size());
+				for (size_t column = 0; column < std::min(expected[row].size(), records[row].size()); column++) {
+					XCTAssertEqual(expected[row][column].content, records[row][column].content);
+				}
+			}
+		}
+		return state;
+	};
+
+	// UTF-16, with and without a byte order mark.  A byte order mark overrides the byte order of the encoding
+	NSString* string = [NSString stringWithUTF8String:text.c_str()];
+	NSData* littleEndian = [string dataUsingEncoding:NSUTF16LittleEndianStringEncoding];
+	NSData* bigEndian = [string dataUsingEncoding:NSUTF16BigEndianStringEncoding];
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"parallel-decoding.csv"];
+
+	XCTAssertTrue([littleEndian writeToFile:path atomically:YES]);
+	XCTAssertEqual(csv::Complete, parseParallel([path fileSystemRepresentation], "UTF-16LE"));
+
+	XCTAssertTrue([bigEndian writeToFile:path atomically:YES]);
+	XCTAssertEqual(csv::Complete, parseParallel([path fileSystemRepresentation], "UTF-16BE"));
+
+	NSMutableData* data = [NSMutableData dataWithBytes:"\xFF\xFE" length:2];
+	[data appendData:littleEndian];
+	XCTAssertTrue([data writeToFile:path atomically:YES]);
+	XCTAssertEqual(csv::Complete, parseParallel([path fileSystemRepresentation], "UTF-16"));
+
+	// Multibyte codepages decoded by ICU
+	NSData* japanese = [string dataUsingEncoding:NSShiftJISStringEncoding allowLossyConversion:YES];
+	XCTAssertTrue([japanese writeToFile:path atomically:YES]);
+	std::vector<csv::record> utf8 = expected;
+	csv::icu::TranscodingFileDataSource transcoded;
+	XCTAssertTrue(transcoded.open([path fileSystemRepresentation], "Shift_JIS"));
+	expected = AddRecords(transcoded);
+	XCTAssertEqual(2000, expected.size());
+	XCTAssertEqual(csv::Complete, parseParallel([path fileSystemRepresentation], "Shift_JIS"));
+
+	NSURL* url = [self resourceWithName:@"korean" extension:@"csv"];
+	XCTAssertNotNil(url);
+	XCTAssertTrue(transcoded.open([url fileSystemRepresentation], "EUC-KR"));
+	expected = AddRecords(transcoded);
+	XCTAssertEqual(csv::Complete, parseParallel([url fileSystemRepresentation], "EUC-KR"));
+
+	// Names of UTF-8 are parsed as UTF-8
+	expected = utf8;
+	XCTAssertTrue([[NSData dataWithBytes:text.data() length:text.size()] writeToFile:path atomically:YES]);
+	XCTAssertEqual(csv::Complete, parseParallel([path fileSystemRepresentation], "utf-8"));
+
+	// Stateful encodings can't be split into chunks
+	XCTAssertEqual(csv::Error, parseParallel([path fileSystemRepresentation], "ISO-2022-JP"));
+	XCTAssertEqual(csv::Error, parseParallel([path fileSystemRepresentation], "not-an-encoding"));
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testICUFileProgress {
+	// EUC-KR text, where each Korean character is two bytes
+	std::string contents;
+	std::vector<size_t> ends;
+	for (size_t row = 0; row < 10000; row++) {
+		contents += std::to_string(row) + ", \xB0\xA1\xB3\xAA, \"\xB4\xD9\r\n\xC7\xD1\"" + ((row % 2) ? "\r\n" : "\n");
+		ends.push_back(contents.size());
+	}
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"progress.csv"];
+	XCTAssertTrue([[NSData dataWithBytes:contents.data() length:contents.size()] writeToFile:path atomically:YES]);
+
+	// The progress of each record is the number of bytes of the file decoded to the end of the record, including
+	// records whose characters are split between the blocks read from the file
+	csv::icu::FileDataSource input;
+	XCTAssertTrue(input.open([path fileSystemRepresentation], "EUC-KR"));
+	std::atomic<size_t> counter(0);
+	input.progressCounter = &counter;
+	std::vector<double> progress;
+	std::vector<size_t> counted;
+	XCTAssertEqual(csv::Complete, csv::parse(input, nullptr, [&progress, &counted, &counter](const csv::record& record, double complete) -> bool {
+		progress.push_back(complete);
+		counted.push_back(counter.load());
+		return true;
+	}));
+	XCTAssertEqual(ends.size(), progress.size());
+	for (size_t row = 0; row < std::min(ends.size(), progress.size()); row++) {
+		XCTAssertEqualWithAccuracy(double(ends[row]) / contents.size(), progress[row], 0.5 / contents.size());
+		XCTAssertEqual(ends[row], counted[row]);
+	}
+	XCTAssertEqual(1.0, progress.back());
+	XCTAssertEqual(contents.size(), input.consumed());
+
+	// The progress of small files isn't rounded up to the end of the file
+	const std::string small = "cat, dog\nfish, \xB0\xA1\n";
+	XCTAssertTrue([[NSData dataWithBytes:small.data() length:small.size()] writeToFile:path atomically:YES]);
+	XCTAssertTrue(input.open([path fileSystemRepresentation], "EUC-KR"));
+	progress.clear();
+	csv::parse(input, nullptr, [&progress](const csv::record& record, double complete) -> bool {
+		progress.push_back(complete);
+		return true;
+	});
+	XCTAssertEqual(2, progress.size());
+	XCTAssertEqualWithAccuracy(9.0 / small.size(), progress[0], 0.0001);
+	XCTAssertEqual(1.0, progress[1]);
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testWriter {
+	// Only the fields containing quotes, separators or line endings (or a leading space) are quoted
+	std::ostringstream stream;
+	{
+		csv::writer output(stream, csv::runtime_dialect(',', '\0', true, true));
+		output.write_field("id");
+		output.write_field("name");
+		output.end_record();
+		output.write_field("1");
+		output.write_field("cat, dog");
+		output.end_record();
+		output.write_field("2");
+		output.write_field("do\"g");
+		output.end_record();
+		output.write_field(" 3");
+		output.write_field("line\r\nbreak");
+		output.end_record();
+		output.write_field("");
+		output.end_record();
+		XCTAssertTrue(output.flush());
+	}
+	XCTAssertEqual("id,name\n1,\"cat, dog\"\n2,\"do\"\"g\"\n\" 3\",\"line\r\nbreak\"\n\"\"\n", stream.str());
+
+	// Long fields with quotes either side of the block boundaries, written through a small buffer
+	std::vector<csv::record> records;
+	for (size_t row = 0; row < 200; row++) {
+		csv::record record;
+		for (size_t column = 0; column < 3; column++) {
+			csv::field field;
+			field.content = std::string(row + column * 61, 'a');
+			if (column == 1) {
+				field.content += "\"" + std::string(row % 7, 'b') + "\"";
+			}
+			else if (column == 2 && (row % 3) == 0) {
+				field.content += "\tc";
+			}
+			record.add(field);
+		}
+		records.push_back(record);
+	}
+
+	stream.str("");
+	{
+		csv::basic_writer<csv::tab_separated> output(stream, csv::tab_separated(), 100);
+		for (const auto& record: records) {
+			output.write_record(record);
+		}
+	}
+
+	csv::utf8::StringDataSource input;
+	XCTAssertTrue(input.set(stream.str()));
+	input.separator = '\t';
+	std::vector<csv::record> parsed = AddRecords(input);
+	XCTAssertEqual(records.size(), parsed.size());
+	for (size_t row = 0; row < std::min(records.size(), parsed.size()); row++) {
+		XCTAssertEqual(records[row].size(), parsed[row].size());
+		for (size_t column = 0; column < std::min(records[row].size(), parsed[row].size()); column++) {
+			XCTAssertEqual(records[row][column].content, parsed[row][column].content);
+		}
+	}
+}
+
+- (void)testRawFields {
+	// Each view reports whether the field was quoted or escaped, along with its text in the data
+	const std::string text = "a, \"b,c\", \"d\"\"e\", \"f\"x,g\"h,,\"\"\n";
+	csv::scanner scanner(csv::runtime_dialect(',', '\0', true, true));
+	scanner.reportFields = false;
+	scanner.materialize = false;
+	scanner.feed(text.data(), text.size());
+	scanner.finish();
+	XCTAssertEqual(csv::scanner::Record, scanner.next());
+
+	const csv::record_view& record = scanner.record_view();
+	XCTAssertEqual(7, record.size());
+	const bool quoted[] = { false, true, true, true, false, false, true };
+	const bool escaped[] = { false, false, true, true, true, false, false };
+	const char* raw[] = { "a", "\"b,c\"", NULL, NULL, NULL, "", "\"\"" };
+	for (size_t column = 0; column < std::min<size_t>(record.size(), 7); column++) {
+		XCTAssertEqual(quoted[column], record[column].quoted);
+		XCTAssertEqual(escaped[column], record[column].escaped);
+		if (raw[column] == NULL) {
+			XCTAssertTrue(record[column].raw == NULL);
+		}
+		else {
+			XCTAssertEqual(std::string(raw[column]), std::string(record[column].raw, record[column].rawSize));
+			XCTAssertTrue(record[column].raw >= text.data() && record[column].raw < text.data() + text.size());
+		}
+	}
+	XCTAssertEqual(csv::scanner::Finished, scanner.next());
+
+	// The raw text is only available for fields within the block holding the end of the record
+	const std::string first = "one,\"tw";
+	const std::string second = "o\",three\n";
+	csv::scanner split(csv::runtime_dialect(',', '\0', true, true));
+	split.reportFields = false;
+	split.materialize = false;
+	split.feed(first.data(), first.size());
+	XCTAssertEqual(csv::scanner::NeedData, split.next());
+	split.feed(second.data(), second.size());
+	split.finish();
+	XCTAssertEqual(csv::scanner::Record, split.next());
+
+	const csv::record_view& view = split.record_view();
+	XCTAssertEqual(3, view.size());
+	XCTAssertEqual("one", view[0].str());
+	XCTAssertTrue(view[0].raw == NULL);
+	XCTAssertEqual("two", view[1].str());
+	XCTAssertTrue(view[1].quoted);
+	XCTAssertFalse(view[1].escaped);
+	XCTAssertTrue(view[1].raw == NULL);
+	XCTAssertEqual("three", view[2].str());
+	XCTAssertTrue(view[2].raw == second.data() + 3);
+	XCTAssertEqual(5, view[2].rawSize);
+}
+
+- (void)testParallelConvert {
+	std::string text = "id, name, notes\r\n";
+	for (size_t row = 0; row < 2000; row++) {
+		text += std::to_string(row) + ", \"name\r\n" + std::to_string(row) + "\", \"a \"\"quoted\"\"\tnote\"\n";
+	}
+
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"parallel_convert.csv"];
+	XCTAssertTrue([[NSData dataWithBytes:text.data() length:text.size()] writeToFile:path atomically:YES]);
+
+	csv::utf8::FileDataSource input;
+	XCTAssertTrue(input.open([path fileSystemRepresentation]));
+	std::vector<csv::record> expected = AddRecords(input);
+	XCTAssertEqual(2001, expected.size());
+
+	// The same records written as TSV on a single thread
+	std::string tsv;
+	{
+		csv::basic_writer<csv::tab_separated> output(tsv);
+		for (const auto& record: expected) {
+			output.write_record(record);
+		}
+	}
+
+	csv::parallel_options options;
+	options.threads = 4;
+	options.chunkSize = 100;
+
+	// Each worker converts its chunks, and the output is delivered in order
+	std::string converted;
+	size_t row = 0;
+	bool rowsMatch = true;
+	XCTAssertEqual(csv::Complete, csv::parallel_convert(input, [](const csv::record_view& record, std::string& output) {
+		csv::basic_writer<csv::tab_separated> writer(output);
+		writer.write_record(record);
+	}, [&converted, &row, &rowsMatch](const csv::converted_chunk& chunk, double progress) -> bool {
+		rowsMatch = rowsMatch && (chunk.row == row) && (chunk.size() > 0) && (chunk.ends.back() == chunk.data.size());
+		row += chunk.size();
+		converted += chunk.data;
+		return true;
+	}, options));
+
+	XCTAssertTrue(rowsMatch);
+	XCTAssertEqual(expected.size(), row);
+	XCTAssertEqual(tsv, converted);
+
+	// Stopping early
+	size_t chunks = 0;
+	XCTAssertEqual(csv::Complete, csv::parallel_convert(input, [](const csv::record_view& record, std::string& output) {
+		output += record[0].str();
+	}, [&chunks](const csv::converted_chunk& chunk, double progress) -> bool {
+		return ++chunks < 3;
+	}, options));
+	XCTAssertEqual(3, chunks);
+
+	// An invalid byte in the middle of the file is replaced as it is on a single thread (by open_file)
+	std::string invalid = text;
+	invalid.insert(invalid.find("\n1000, ") + 3, "\xFF");
+	XCTAssertTrue([[NSData dataWithBytes:invalid.data() length:invalid.size()] writeToFile:path atomically:YES]);
+
+	std::unique_ptr<csv::utf8::DataSource> single = csv::icu::open_file([path fileSystemRepresentation], "UTF-8");
+	XCTAssertTrue(single != nullptr);
+	tsv.clear();
+	if (single) {
+		csv::basic_writer<csv::tab_separated> output(tsv);
+		for (const auto& record: AddRecords(*single)) {
+			output.write_record(record);
+		}
+	}
+	XCTAssertNotEqual(std::string::npos, tsv.find("10\xEF\xBF\xBD""00"));
+
+	XCTAssertTrue(input.open([path fileSystemRepresentation]));
+	input.validate = csv::utf8::validation::Replace;
+	converted.clear();
+	XCTAssertEqual(csv::Complete, csv::parallel_convert(input, [](const csv::record_view& record, std::string& output) {
+		csv::basic_writer<csv::tab_separated> writer(output);
+		writer.write_record(record);
+	}, [&converted](const csv::converted_chunk& chunk, double progress) -> bool {
+		converted += chunk.data;
+		return true;
+	}, options));
+	XCTAssertEqual(tsv, converted);
+	XCTAssertEqual(1001, input.invalid.row);
+
+	[[NSFileManager defaultManager] removeItemAtPath:path error:nil];
+}
+
+- (void)testProjection {
+	// The second line only has content in the skipped columns, so it isn't a blank line
+	const std::string text = "id, name, \"no\"\"tes\"\n, \"skipped\"\n\n2, dog, \"fish\nchips\"\n3";
+	std::vector<csv::record> expected = AddRecords(text);
+	XCTAssertEqual(4, expected.size());
+
+	const csv::projection projection(std::vector<size_t> { 2, 0 });
+	XCTAssertTrue(projection.includes(0));
+	XCTAssertFalse(projection.includes(1));
+	XCTAssertTrue(projection.includes(2));
+	XCTAssertFalse(projection.includes(3));
+
+	// Only the selected columns have content.  The records keep their columns and row numbers
+	auto matches = [&expected](const std::vector<csv::record>& records) -> bool {
+		if (records.size() != expected.size()) {
+			return false;
+		}
+		for (size_t row = 0; row < records.size(); row++) {
+			if (records[row].row != row || records[row].size() != expected[row].size()) {
+				return false;
+			}
+			for (size_t column = 0; column < records[row].size(); column++) {
+				const std::string content = (column == 1) ? std::string() : expected[row][column].content;
+				if (records[row][column].column != column || records[row][column].content != content) {
+					return false;
+				}
+			}
+		}
+		return true;
+	};
+
+	csv::utf8::StringDataSource input;
+	XCTAssertTrue(input.set(text));
+	input.columns = projection;
+	XCTAssertTrue(matches(AddRecords(input)));
+
+	std::vector<csv::record> records;
+	bool skipped = true;
+	XCTAssertTrue(input.set(text));
+	XCTAssertEqual(csv::Complete, csv::parse(input, [&records, &skipped](const csv::record_view& record, double progress) -> bool {
+		skipped = skipped && (record.size() < 2 || (record[1].size == 0 && record[1].raw == NULL));
+		records.push_back(record.record());
+		return true;
+	}));
+	XCTAssertTrue(skipped);
+	XCTAssertTrue(matches(records));
+
+	// The character parser skips the same fields
+	csv::icu::StringDataSource unicode;
+	XCTAssertTrue(unicode.set(text, "UTF-8"));
+	unicode.columns = projection;
+	XCTAssertTrue(matches(AddRecords(unicode)));
+}
+
+- (void)testFilter {
+	csv::predicate prefix(1, csv::predicate::Prefix, "do");
+	XCTAssertTrue(prefix.matches("dog", 3));
+	XCTAssertFalse(prefix.matches("d", 1));
+	XCTAssertTrue(csv::predicate(1, csv::predicate::Contains, "nk").matches("donkey", 6));
+	XCTAssertTrue(csv::predicate(1, csv::predicate::Contains, "").matches("", 0));
+	XCTAssertTrue(csv::predicate(1, csv::predicate::NotEquals, "dog").matches("do", 2));
+	XCTAssertTrue(csv::predicate(2, csv::predicate::GreaterOrEqual, "5").matches("10 ", 3));
+	XCTAssertFalse(csv::predicate(2, csv::predicate::Less, "5").matches("n/a", 3));
+	XCTAssertFalse(csv::predicate(2, csv::predicate::Less, "5").matches("", 0));
+	XCTAssertFalse(csv::predicate(2, csv::predicate::Less, "five").valid());
+
+	// Only decimal numbers are compared, whatever the locale
+	double number = 0.0;
+	XCTAssertTrue(csv::predicate::parse_number("-2.5e1 ", 7, number));
+	XCTAssertEqual(-25.0, number);
+	XCTAssertTrue(csv::predicate::parse_number(".5", 2, number));
+	XCTAssertEqual(0.5, number);
+	XCTAssertTrue(csv::predicate::parse_number("0.1", 3, number));
+	XCTAssertEqual(0.1, number);
+	XCTAssertTrue(csv::predicate::parse_number("12345678901234567890.5", 22, number));
+	XCTAssertEqualWithAccuracy(12345678901234567890.5, number, 1e5);
+	const char* invalid[] = { "nan", "NAN", "inf", "-infinity", "0x1p3", " 5", "\t5", "5 x", "1e", "e5", ".", "-", "1.2.3", "1,5" };
+	for (const char* text: invalid) {
+		XCTAssertFalse(csv::predicate::parse_number(text, strlen(text), number));
+	}
+	XCTAssertFalse(csv::predicate(2, csv::predicate::Less, "inf").valid());
+	XCTAssertFalse(csv::predicate(2, csv::predicate::Greater, "0").matches("nan", 3));
+
+	const std::string previous = setlocale(LC_NUMERIC, NULL);
+	if (setlocale(LC_NUMERIC, "de_DE.UTF-8") != NULL || setlocale(LC_NUMERIC, "de_DE") != NULL) {
+		XCTAssertTrue(csv::predicate(2, csv::predicate::Less, "2.5").matches("2.25", 4));
+		XCTAssertFalse(csv::predicate(2, csv::predicate::Less, "2.5").matches("2,25", 4));
+	}
+	setlocale(LC_NUMERIC, previous.c_str());
+
+	csv::filter filter;
+	XCTAssertTrue(filter.empty());
+	XCTAssertFalse(filter.add(2, csv::predicate::Less, "five"));
+	XCTAssertTrue(filter.empty());
+	XCTAssertTrue(filter.add(prefix));
+	XCTAssertTrue(filter.add(2, csv::predicate::GreaterOrEqual, "5"));
+	XCTAssertFalse(filter.tests(0));
+	XCTAssertTrue(filter.tests(2));
+	XCTAssertFalse(filter.matches(2, "2.5", 3));
+
+	// Only the records passing every predicate are returned, with their own row numbers
+	const std::string text = "id, name, price\n1, dog, 10\n2, cat, 2.5\n3, donkey, n/a\n4, \"do\"\"g\", 12\n5, dog";
+	auto matches = [](const std::vector<csv::record>& records, bool projected) -> bool {
+		if (records.size() != 2 || records[0].row != 1 || records[1].row != 4) {
+			return false;
+		}
+		const std::vector<std::string> contents[] = { { "1", "dog", "10" }, { "4", "do\"g", "12" } };
+		for (size_t row = 0; row < records.size(); row++) {
+			for (size_t column = 0; column < 3; column++) {
+				const std::string content = (projected && column != 0) ? std::string() : contents[row][column];
+				if (records[row][column].content != content) {
+					return false;
+				}
+			}
+		}
+		return true;
+	};
+
+	csv::utf8::StringDataSource input;
+	XCTAssertTrue(input.set(text));
+	input.filter = filter;
+	XCTAssertTrue(matches(AddRecords(input), false));
+
+	// The filtered columns don't have to be in the projection
+	XCTAssertTrue(input.set(text));
+	input.columns = csv::projection(std::vector<size_t> { 0 });
+	XCTAssertTrue(matches(AddRecords(input), true));
+
+	// The character parser returns the same records
+	csv::icu::StringDataSource unicode;
+	XCTAssertTrue(unicode.set(text, "UTF-8"));
+	unicode.filter = filter;
+	XCTAssertTrue(matches(AddRecords(unicode), false));
+
+	// A header is returned whether or not it passes
+	input.columns = csv::projection();
+	input.filter.header = true;
+	XCTAssertTrue(input.set(text));
+	std::vector<csv::record> records = AddRecords(input);
+	XCTAssertEqual(3, records.size());
+	XCTAssertEqual(0, records[0].row);
+	XCTAssertEqual("price", records[0][2].content);
+	csv::icu::StringDataSource unicodeHeader;
+	XCTAssertTrue(unicodeHeader.set(text, "UTF-8"));
+	unicodeHeader.filter = input.filter;
+	XCTAssertEqual(3, AddRecords(unicodeHeader).size());
+
+	// The row numbers of records parsed in parallel count the rejected records in earlier chunks
+	std::string big;
+	for (size_t row = 0; row < 2000; row++) {
+		big += std::to_string(row) + ", \"name\n" + std::to_string(row) + "\"\n";
+	}
+	NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent:@"parallel_filter.csv"];
+	XCTAssertTrue([[NSData dataWithBytes:big.data() length:big.size()] writeToFile:path atomically:YES]);
+
+	csv::utf8::FileDataSource file;
+	XCTAssertTrue(file.open([path fileSystemRepresentation]));
+	file.filter.add(0, csv::predicate::Contains, "7");
+
+	csv::parallel_options options;
+	options.threads = 4;
+	options.chunkSize = 100;
+
+	records.clear();
+	XCTAssertEqual(csv::Complete, csv::parallel_parse(file, [&records](const csv::record& record, double progress) -> bool {
+		records.push_back(record);
+		return true;
+	}, options));
+
+	size_t expected = 0;
+	bool rowsMatch = true;
+	for (size_t row = 0; row < 2000; row++) {
+		const std::string id = std::to_string(row);
+		if (id.find('7') == std::string::npos) {
+			continue;
+		}
+		rowsMatch = rowsMatch && expected < records.size() && records[expected].row == row && records[expected][0].content == id;
+		expected++;
+	}
+	XCTAssertTrue(rowsMatch);
+	XCTAssertEqual(expected, records.size());
+
+	// Only the first chunk starts with the header
+	file.filter.header = true;
+	records.clear();
+	XCTAssertEqual(csv::Complete, csv::parallel_parse(file, [&records](const csv::record& record, double progress) -> bool {
+		records.push_back(record);
+		return true;
+	}, options));
+	XCTAssertEqual(expected + 1, records.size());
+	XCTAssertEqual(0, records[0].row);
+	XCTAssertEqual(7, records[1].row);
+}
+
 @end
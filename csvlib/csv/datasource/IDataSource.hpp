@@ -26,6 +26,8 @@
 #include <vector>
 #include <assert.h>
 
+#include <csv/filter.hpp>
+
 namespace csv {
 
 class file_exception: public std::exception {
@@ -40,6 +42,53 @@ class data_exception: public std::exception {
 	}
 };
 
+/// A contiguous block of bytes supplied by a block-oriented data source
+struct block {
+	block() {}
+	block(const char* data, size_t size, bool eof)
+		: data(data), size(size), eof(eof) {}
+
+	/// The start of the block
+	const char* data = NULL;
+	/// The number of bytes in the block
+	size_t size = 0;
+	/// True if there is no more data following this block
+	bool eof = true;
+};
+
+/// The columns of each record to build.  An empty projection (the default) builds every column.
+///
+/// The fields in the other columns are skipped -- they are still parsed (to locate the end of each field), but their
+/// content isn't unescaped or copied and is left empty in the record.  The records keep their column numbers.
+class projection {
+public:
+	projection() {}
+	projection(const std::vector<size_t>& columns) {
+		for (const size_t column: columns) {
+			select(column);
+		}
+	}
+
+	/// Include a column
+	inline void select(size_t column) {
+		if (column >= _selected.size()) {
+			_selected.resize(column + 1, 0);
+		}
+		_selected[column] = 1;
+	}
+
+	/// Are all of the columns included?
+	inline bool all() const { return _selected.empty(); }
+
+	/// Is the column included?
+	inline bool includes(size_t column) const {
+		return _selected.empty() || (column < _selected.size() && _selected[column] != 0);
+	}
+
+private:
+	std::vector<char> _selected;
+};
+
 /// Abstract base class for CSV/TSV data sources
 class IDataSource {
 
@@ -54,6 +103,12 @@ public:
 	/// Ignore (step over) blank lines rather than return a blank record for empty lines
 	bool skipBlankLines = true;
 
+	/// The columns to build (by default, all of them)
+	csv::projection columns;
+
+	/// The predicates that records must pass to be returned (by default, none)
+	csv::filter filter;
+
 	/// Set to true to cancel the current parsing
 	bool cancelled = false;
 
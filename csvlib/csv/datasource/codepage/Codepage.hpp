@@ -0,0 +1,68 @@
+//
+//  Codepage.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+// Built-in decoders for single byte codepages (eg. windows-1252 or ISO-8859-1) that don't require ICU.
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace csv {
+namespace codepage {
+
+	/// Decodes a single byte codepage to UTF-8 through a table of the UTF-8 encoding of each byte.
+	///
+	/// The codepages are all compatible with ASCII, so runs of ASCII are copied unchanged (a block at a time).
+	/// Decoding is stateless, so data can be decoded in pieces split at any byte, or concurrently.
+	class table {
+	public:
+		/// The most UTF-8 bytes produced when decoding a single byte
+		static const size_t MAX_EXPANSION = 3;
+
+		/// Build the table for a codepage given the code points of bytes 0x80 to 0xFF
+		table(const char* name, const uint16_t (&upper)[128]);
+
+		table(const table&) = delete;
+		table& operator=(const table&) = delete;
+
+		/// The name of the codepage
+		inline const char* name() const { return _name; }
+
+		/// Decode 'size' bytes of data to UTF-8, returning the number of bytes written to 'out'.  'out' must have
+		/// room for size * MAX_EXPANSION bytes
+		size_t decode(const char* data, size_t size, char* out) const;
+
+	private:
+		const char* _name;
+
+		// The UTF-8 encoding of each byte from 0x80, and its length
+		char _utf8[128][MAX_EXPANSION];
+		uint8_t _length[128];
+	};
+
+	/// Returns the decoder for a codepage, or NULL if it isn't supported.  Names are matched ignoring case and
+	/// punctuation (so "ISO-8859-1", "iso8859_1" and "latin1" are all accepted).
+	///
+	/// Supported codepages are ISO-8859-1, -2, -5, -7, -9 and -15, windows-1250 to windows-1254 and KOI8-R
+	const table* find(const char* name);
+};
+};
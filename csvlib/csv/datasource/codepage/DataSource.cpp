@@ -0,0 +1,141 @@
+//
+//  DataSource.cpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <algorithm>
+
+#include "DataSource.hpp"
+
+namespace csv {
+namespace codepage {
+
+	/// The number of bytes of the file decoded at a time
+	static const size_t DECODE_BLOCK_SIZE = 1024 * 1024;
+
+	FileDataSource::~FileDataSource() {
+		close();
+	}
+
+	bool FileDataSource::open(const char* file, const char* codepage) {
+
+		// Close if we have one open already
+		close();
+
+		_table = find(codepage);
+		if (_table == NULL) {
+			return false;
+		}
+
+		_in.open(file, std::ifstream::in | std::ifstream::binary);
+		if (!_in.is_open()) {
+			close();
+			return false;
+		}
+		_in.seekg(0, std::ios::end);
+		_length = _in.tellg();
+		_in.seekg(0, std::ios::beg);
+
+		_input.resize(DECODE_BLOCK_SIZE);
+		_output.resize(DECODE_BLOCK_SIZE * table::MAX_EXPANSION);
+		return true;
+	}
+
+	void FileDataSource::close() {
+		reset();
+		if (_in.is_open()) {
+			_in.close();
+		}
+		_in.clear();
+		_table = NULL;
+		_length = 0;
+		_outputBefore = _blockSize = 0;
+		_inputBefore = _inputAfter = 0;
+	}
+
+	csv::block FileDataSource::read_block() {
+		_outputBefore += _blockSize;
+		_inputBefore = _inputAfter;
+		_blockSize = 0;
+
+		if (_table == NULL || !_in.is_open()) {
+			return csv::block(NULL, 0, true);
+		}
+
+		_in.read(_input.data(), _input.size());
+		const size_t count = static_cast<size_t>(_in.gcount());
+		const bool eof = (count < _input.size());
+		_inputAfter += count;
+
+		if (utf8::validation::is_ascii(_input.data(), count)) {
+			// ASCII is the same in UTF-8, so the block doesn't need decoding
+			_blockSize = count;
+			return csv::block(_input.data(), count, eof);
+		}
+		_blockSize = _table->decode(_input.data(), count, _output.data());
+		return csv::block(_output.data(), _blockSize, eof);
+	}
+
+	double FileDataSource::progress_at(size_t position) const {
+		if (_length <= 0) {
+			return 1.0;
+		}
+
+		// Interpolate the position within the current block to the bytes of the file it was decoded from
+		double pos = _inputBefore;
+		if (_blockSize > 0 && position > _outputBefore) {
+			const double fraction = static_cast<double>(position - _outputBefore) / _blockSize;
+			pos += std::min(fraction, 1.0) * (_inputAfter - _inputBefore);
+		}
+		double len = _length;
+		return std::min(pos / len, 1.0);
+	}
+
+	bool StringDataSource::set(const std::string& data, const char* codepage) {
+		reset();
+		_decoded.clear();
+		_read = false;
+
+		const table* decoder = find(codepage);
+		if (decoder == NULL) {
+			return false;
+		}
+
+		_decoded.resize(data.size() * table::MAX_EXPANSION);
+		_decoded.resize(decoder->decode(data.data(), data.size(), &_decoded[0]));
+		return true;
+	}
+
+	csv::block StringDataSource::read_block() {
+		if (_read) {
+			return csv::block();
+		}
+
+		// The entire string is a single block
+		_read = true;
+		return csv::block(_decoded.data(), _decoded.size(), true);
+	}
+
+	double StringDataSource::progress_at(size_t position) const {
+		double pos = position;
+		double len = _decoded.length();
+		return std::min(pos / len, 1.0);
+	}
+};
+};
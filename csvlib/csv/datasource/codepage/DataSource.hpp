@@ -0,0 +1,105 @@
+//
+//  DataSource.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <csv/datasource/utf8/DataSource.hpp>
+
+#include "Codepage.hpp"
+
+namespace csv {
+namespace codepage {
+
+	/// A file in a single byte codepage, decoded to UTF-8 a block at a time using the built-in codepage tables
+	/// (so ICU isn't required)
+	class FileDataSource final: public utf8::DataSource {
+	public:
+		FileDataSource() noexcept {}
+		~FileDataSource();
+
+		FileDataSource(const FileDataSource&) = delete;
+		FileDataSource& operator=(const FileDataSource&) = delete;
+
+		/// Throws csv::file_exception if unable to open file or the codepage isn't supported
+		FileDataSource(const char* file, const char* codepage) {
+			if (!open(file, codepage)) {
+				throw csv::file_exception();
+			}
+		}
+
+		/// Open a file.  Returns false if the file can't be opened or the codepage isn't supported (see codepage::find())
+		bool open(const char* file, const char* codepage);
+		void close();
+
+		/// The codepage of the open file
+		inline const table* decoder() const { return _table; }
+
+	public:
+		virtual csv::block read_block();
+		virtual double progress_at(size_t position) const;
+
+	private:
+		const table* _table = NULL;
+
+		std::ifstream _in;
+		long long _length = 0;
+
+		// Data read from the file, and the UTF-8 it was decoded to
+		std::vector<char> _input;
+		std::vector<char> _output;
+
+		// The positions of the current block, for progress
+		size_t _outputBefore = 0;
+		size_t _blockSize = 0;
+		size_t _inputBefore = 0;
+		size_t _inputAfter = 0;
+	};
+
+	/// A string in a single byte codepage.  The string is decoded to UTF-8 when it is set
+	class StringDataSource final: public utf8::DataSource {
+	public:
+		StringDataSource() noexcept {}
+
+		/// Throws csv::data_exception if the codepage isn't supported
+		StringDataSource(const std::string& data, const char* codepage) {
+			if (!set(data, codepage)) {
+				throw csv::data_exception();
+			}
+		}
+
+		/// Returns false if the codepage isn't supported
+		bool set(const std::string& data, const char* codepage);
+
+	public:
+		virtual csv::block read_block();
+		virtual double progress_at(size_t position) const;
+
+	private:
+		std::string _decoded;
+		// Has the string been returned by read_block()?
+		bool _read = false;
+	};
+};
+};
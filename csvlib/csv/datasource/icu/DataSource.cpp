@@ -24,29 +24,18 @@
 
 #ifdef ALLOW_ICU_EXTENSIONS
 
+#include <string.h>
+#include <sys/stat.h>
+
 #include "Encoding.hpp"
 
+#include <csv/datasource/utf8/Validation.hpp>
+#include <csv/datasource/codepage/DataSource.hpp>
+#include <csv/datasource/utf16/DataSource.hpp>
+
 namespace csv {
 namespace icu {
 
-	bool DataSource::is_eol() {
-		if (_current == '\r') {
-			if (next() == false) {
-				// Hit the end of file.  Return true and let the caller handle it
-				return true;
-			}
-
-			if (_current != '\n') {
-				back();
-			}
-			return true;
-		}
-		else if (_current == '\n') {
-			return true;
-		}
-		return false;
-	}
-
 	std::string DataSource::field() const {
 		std::string converted;
 		_field.toUTF8String(converted);
@@ -55,6 +44,20 @@ namespace icu {
 };
 
 namespace icu {
+
+	/// Detects the encoding of a stream from its start, which is read ahead (see utf8::FileDataSource::peek())
+	/// so that the stream can still be parsed from its start
+	static encoding::detected_language TextEncodingForStream(utf8::FileDataSource& stream) {
+		const csv::block sample = stream.peek(4096);
+		return encoding::TextEncodingForData(sample.data, sample.size);
+	}
+
+	/// The number of bytes read from the file at a time by FileDataSource
+	static const size_t FILE_BLOCK_SIZE = 64 * 1024;
+
+	/// The number of UTF-16 units decoded at a time by FileDataSource
+	static const size_t FILE_UNITS_SIZE = 16 * 1024;
+
 	bool FileDataSource::open(const char* file, const char* codepage) {
 
 		// Close if we have one open already
@@ -69,58 +72,527 @@ namespace icu {
 			file_codepage = detected.name;
 		}
 
-		_in = u_fopen(file, "rb", NULL, file_codepage.c_str());
-		if (_in != NULL) {
-			FILE* internal_file = u_fgetfile(_in);
-			fseek(internal_file, 0L, SEEK_END);
-			_length = ftell(internal_file);
-			fseek(internal_file, 0L, SEEK_SET);
+		UErrorCode status = U_ZERO_ERROR;
+		_converter = ucnv_open(file_codepage.c_str(), &status);
+		if (U_FAILURE(status)) {
+			_converter = NULL;
+			return false;
+		}
+
+		_in.open(file, std::ifstream::in | std::ifstream::binary);
+		if (!_in.is_open()) {
+			close();
+			return false;
 		}
+		_in.seekg(0, std::ios::end);
+		const long long length = _in.tellg();
+		_in.seekg(0, std::ios::beg);
+		_length = (length > 0) ? static_cast<size_t>(length) : 0;
 
-		return _in != NULL;
+		_input.resize(FILE_BLOCK_SIZE);
+		_source = _sourceLimit = _input.data();
+		_units.resize(FILE_UNITS_SIZE);
+		_offsets.resize(FILE_UNITS_SIZE);
+		_ends.resize(FILE_UNITS_SIZE);
+		return true;
 	}
 
 	void FileDataSource::close() {
-		if (_in != NULL) {
-			u_fclose(_in);
-			_in = NULL;
+		if (_in.is_open()) {
+			_in.close();
+		}
+		_in.clear();
+		if (_converter != NULL) {
+			ucnv_close(_converter);
+			_converter = NULL;
 		}
+		_length = 0;
+		_flushed = false;
+		_source = _sourceLimit = NULL;
+		_inputOffset = 0;
+		_inputEOF = false;
+		_unit = _unitCount = 0;
+		_end = _prevEnd = 0;
+		_unread = false;
+		_prev = _current = 0;
 	}
 
 	FileDataSource::~FileDataSource() {
-		u_fclose(_in);
+		close();
+	}
+
+	size_t FileDataSource::pending() const {
+		UErrorCode status = U_ZERO_ERROR;
+		const int32_t count = ucnv_toUCountPending(_converter, &status);
+		return (U_SUCCESS(status) && count > 0) ? static_cast<size_t>(count) : 0;
+	}
+
+	bool FileDataSource::decode() {
+		_unit = _unitCount = 0;
+		while (_converter != NULL && !_flushed) {
+			if (_source == _sourceLimit && !_inputEOF) {
+				// Read the next block of the file.  Partial characters are held by the converter
+				_inputOffset += _sourceLimit - _input.data();
+				_in.read(_input.data(), _input.size());
+				const size_t count = static_cast<size_t>(_in.gcount());
+				_source = _input.data();
+				_sourceLimit = _source + count;
+				_inputEOF = (count < _input.size());
+			}
+
+			UChar* target = _units.data();
+			UChar* const targetLimit = _units.data() + _units.size();
+			UErrorCode status = U_ZERO_ERROR;
+
+			// The offsets ICU returns for a character completed from bytes held over from the previous block aren't
+			// reliable for every converter, so that character is completed a byte at a time
+			while (_source < _sourceLimit && U_SUCCESS(status) && pending() > 0) {
+				UChar* const before = target;
+				ucnv_toUnicode(_converter, &target, targetLimit, &_source, _source + 1, NULL, false, &status);
+				const size_t end = _inputOffset + (_source - _input.data()) - pending();
+				for (UChar* unit = before; unit < target; unit++) {
+					_ends[unit - _units.data()] = end;
+				}
+			}
+			if (U_FAILURE(status)) {
+				_flushed = true;
+				_unitCount = target - _units.data();
+				return _unitCount > 0;
+			}
+
+			const char* start = _source;
+			const size_t startOffset = _inputOffset + (start - _input.data());
+			const size_t first = target - _units.data();
+			ucnv_toUnicode(_converter, &target, targetLimit, &_source, _sourceLimit,
+						   _offsets.data() + first, _inputEOF, &status);
+			if (status == U_BUFFER_OVERFLOW_ERROR) {
+				status = U_ZERO_ERROR;
+			}
+			else if (U_FAILURE(status) || (_inputEOF && _source == _sourceLimit)) {
+				// The file has been decoded (or can't be)
+				_flushed = true;
+			}
+			_unitCount = target - _units.data();
+
+			// Each unit ends where the following unit starts.  Units produced from bytes held over from an earlier
+			// call have no offset.  The last unit ends before the bytes of any partial character held by the converter
+			size_t end = _inputOffset + (_source - _input.data()) - pending();
+			for (size_t index = _unitCount; index > first; index--) {
+				_ends[index - 1] = end;
+				if (_offsets[index - 1] >= 0) {
+					end = startOffset + static_cast<size_t>(_offsets[index - 1]);
+				}
+			}
+
+			if (_unitCount > 0) {
+				return true;
+			}
+		}
+		return false;
 	}
 
 	bool FileDataSource::next() {
-		if (u_feof(_in)) {
+		if (_unread) {
+			// Return the character moved back over
+			_unread = false;
+			_prev = _current;
+			_prevEnd = _end;
+			_current = _next;
+			_end = _nextEnd;
+			return true;
+		}
+
+		if (_unit == _unitCount && !decode()) {
 			return false;
 		}
 
-		_prev = _current;
-		_current = u_fgetc(_in);
+		UChar32 ch = _units[_unit];
+		size_t end = _ends[_unit];
+		_unit++;
+		if (U16_IS_LEAD(ch) && (_unit < _unitCount || decode()) && U16_IS_TRAIL(_units[_unit])) {
+			ch = U16_GET_SUPPLEMENTARY(ch, _units[_unit]);
+			end = _ends[_unit];
+			_unit++;
+		}
 
+		_prev = _current;
+		_prevEnd = _end;
+		_current = ch;
+		_end = end;
+		if (progressCounter != NULL) {
+			progressCounter->store(_end, std::memory_order_relaxed);
+		}
 		return true;
 	}
 
 	void FileDataSource::back() {
-		u_fungetc(_current, _in);
+		_unread = true;
+		_next = _current;
+		_nextEnd = _end;
 		_current = _prev;
+		_end = _prevEnd;
 		_prev = 0;
 	}
 
 	double FileDataSource::progress() {
-		// ICU appears to perform buffering from the underlying file handle in order to optimize reading
-		// As such this method is not byte-accurate as it will depend on how much data ICU buffers during reading
-		// So, for small files the progress will always be 1.0, however for larger files it will chunk.
-		FILE* internal_file = u_fgetfile(_in);
-		double pos = ftell(internal_file);
-		double len = _length;
-		return std::min(pos / len, 1.0);
+		if (_length == 0) {
+			return 1.0;
+		}
+		return std::min(static_cast<double>(_end) / _length, 1.0);
 	}
 };
 
 namespace icu {
 
+	/// The number of bytes read from the file at a time
+	static const size_t TRANSCODE_BLOCK_SIZE = 1024 * 1024;
+
+	/// The number of UTF-16 characters held between the converters
+	static const size_t TRANSCODE_PIVOT_SIZE = 64 * 1024;
+
+	TranscodingDataSource::~TranscodingDataSource() {
+		close_converters();
+	}
+
+	bool TranscodingDataSource::open_converters(const char* codepage, size_t length) {
+		UErrorCode status = U_ZERO_ERROR;
+		_converter = ucnv_open(codepage, &status);
+		_utf8 = ucnv_open("UTF-8", &status);
+		if (U_FAILURE(status)) {
+			close_converters();
+			return false;
+		}
+
+		_length = length;
+		_pivot.resize(TRANSCODE_PIVOT_SIZE);
+		_pivotSource = _pivotTarget = _pivot.data();
+		_output.resize(TRANSCODE_BLOCK_SIZE * 2);
+		return true;
+	}
+
+	void TranscodingDataSource::close_converters() {
+		reset();
+		if (_converter != NULL) {
+			ucnv_close(_converter);
+			_converter = NULL;
+		}
+		if (_utf8 != NULL) {
+			ucnv_close(_utf8);
+			_utf8 = NULL;
+		}
+		_length = 0;
+		_reset = true;
+		_flushed = false;
+		_source = _sourceLimit = NULL;
+		_inputEOF = false;
+		_inputRead = 0;
+		_pivotSource = _pivotTarget = NULL;
+		_first = true;
+		_outputBefore = _blockSize = 0;
+		_inputBefore = _inputAfter = 0;
+	}
+
+	csv::block TranscodingDataSource::read_block() {
+		_outputBefore += _blockSize;
+		_inputBefore = _inputAfter;
+		_blockSize = 0;
+
+		if (_converter == NULL || _flushed) {
+			return csv::block(NULL, 0, true);
+		}
+
+		char* target = _output.data();
+		char* const targetLimit = target + _output.size();
+
+		// Convert until the output is full or the file has been converted
+		while (!_flushed) {
+			if (_source == _sourceLimit && !_inputEOF) {
+				fill();
+			}
+
+			UErrorCode status = U_ZERO_ERROR;
+			ucnv_convertEx(_utf8, _converter,
+						   &target, targetLimit,
+						   &_source, _sourceLimit,
+						   _pivot.data(), &_pivotSource, &_pivotTarget, _pivot.data() + _pivot.size(),
+						   _reset, _inputEOF, &status);
+			_reset = false;
+
+			if (status == U_BUFFER_OVERFLOW_ERROR) {
+				break;
+			}
+			if (U_FAILURE(status) || _inputEOF) {
+				// The conversion has been completed (or can't continue)
+				_flushed = true;
+			}
+		}
+
+		const char* data = _output.data();
+		size_t size = target - data;
+
+		if (_first) {
+			// Remove the byte order mark, if the converter hasn't
+			_first = false;
+			if (size >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+				data += 3;
+				size -= 3;
+			}
+		}
+
+		_blockSize = size;
+		_inputAfter = _inputRead - (_sourceLimit - _source);
+		if (progressCounter != NULL) {
+			progressCounter->store(_inputAfter, std::memory_order_relaxed);
+		}
+		return csv::block(data, size, _flushed);
+	}
+
+	double TranscodingDataSource::progress_at(size_t position) const {
+		if (_length <= 0) {
+			return 1.0;
+		}
+
+		// Interpolate the position within the current block to the bytes of the file it was converted from
+		double pos = _inputBefore;
+		if (_blockSize > 0 && position > _outputBefore) {
+			const double fraction = static_cast<double>(position - _outputBefore) / _blockSize;
+			pos += std::min(fraction, 1.0) * (_inputAfter - _inputBefore);
+		}
+		double len = _length;
+		return std::min(pos / len, 1.0);
+	}
+
+	TranscodingFileDataSource::~TranscodingFileDataSource() {
+		close();
+	}
+
+	bool TranscodingFileDataSource::open(const char* file, const char* codepage) {
+
+		// Close if we have one open already
+		close();
+
+		struct stat info;
+		if (::stat(file, &info) == 0 && !S_ISREG(info.st_mode)) {
+			// A pipe (or other stream) can only be read once, so its codepage is detected from the data it is
+			// converted from
+			std::unique_ptr<utf8::FileDataSource> stream(new utf8::FileDataSource());
+			return stream->open(file) && open(std::move(stream), codepage);
+		}
+
+		std::string file_codepage = codepage ?: "";
+		if (file_codepage.length() == 0) {
+			const auto detected = encoding::TextEncodingForFile(file);
+			if (detected.invalid()) {
+				return false;
+			}
+			file_codepage = detected.name;
+		}
+
+		_in.open(file, std::ifstream::in | std::ifstream::binary);
+		if (!_in.is_open()) {
+			close();
+			return false;
+		}
+		_in.seekg(0, std::ios::end);
+		const long long length = _in.tellg();
+		_in.seekg(0, std::ios::beg);
+
+		if (!open_converters(file_codepage.c_str(), length > 0 ? static_cast<size_t>(length) : 0)) {
+			close();
+			return false;
+		}
+
+		_input.resize(TRANSCODE_BLOCK_SIZE);
+		return true;
+	}
+
+	bool TranscodingFileDataSource::open(std::unique_ptr<utf8::FileDataSource> stream, const char* codepage) {
+
+		// Close if we have one open already
+		close();
+		if (!stream) {
+			return false;
+		}
+
+		std::string stream_codepage = codepage ?: "";
+		if (stream_codepage.length() == 0) {
+			const auto detected = TextEncodingForStream(*stream);
+			if (detected.invalid()) {
+				return false;
+			}
+			stream_codepage = detected.name;
+		}
+
+		if (!open_converters(stream_codepage.c_str(), stream->has_length() ? stream->length() : 0)) {
+			close();
+			return false;
+		}
+		_stream = std::move(stream);
+		return true;
+	}
+
+	void TranscodingFileDataSource::close() {
+		close_converters();
+		if (_in.is_open()) {
+			_in.close();
+		}
+		_in.clear();
+		_stream.reset();
+	}
+
+	bool TranscodingFileDataSource::fill() {
+		if (_stream) {
+			// Convert whatever has arrived
+			const csv::block block = _stream->read_block();
+			_source = block.data;
+			_sourceLimit = _source + block.size;
+			_inputRead += block.size;
+			_inputEOF = block.eof;
+			return block.size > 0;
+		}
+
+		_in.read(_input.data(), _input.size());
+		const size_t count = static_cast<size_t>(_in.gcount());
+		_source = _input.data();
+		_sourceLimit = _source + count;
+		_inputRead += count;
+		_inputEOF = (count < _input.size());
+		return count > 0;
+	}
+
+	bool TranscodingStringDataSource::set(std::string text, const char* codepage) {
+		close_converters();
+		_text = std::move(text);
+
+		std::string cp = codepage ?: "";
+		if (cp.length() == 0) {
+			const auto detected = encoding::SampledCandidatesForData(_text.data(), _text.size()).best();
+			if (detected.invalid()) {
+				return false;
+			}
+			cp = detected.name;
+		}
+		return open_converters(cp.c_str(), _text.size());
+	}
+
+	bool TranscodingStringDataSource::fill() {
+		// The string is converted directly, in pieces as large as the output buffer allows
+		_source = _text.data();
+		_sourceLimit = _source + _text.size();
+		_inputRead = _text.size();
+		_inputEOF = true;
+		return !_text.empty();
+	}
+
+	/// Is the codepage UTF-16?  If so, 'order' is set to the byte order used if the data doesn't start with a
+	/// byte order mark
+	static bool IsUTF16(const std::string& codepage, utf16::ByteOrder& order) {
+		if (ucnv_compareNames(codepage.c_str(), "UTF-16LE") == 0) {
+			order = utf16::LittleEndian;
+			return true;
+		}
+		if (ucnv_compareNames(codepage.c_str(), "UTF-16BE") == 0 ||
+			ucnv_compareNames(codepage.c_str(), "UTF-16") == 0) {
+			order = utf16::BigEndian;
+			return true;
+		}
+		return false;
+	}
+
+	/// Open a pipe (or other stream) for parsing.  It can only be read once, so it's opened once, and its
+	/// codepage is detected from its start, which is kept to be parsed
+	static std::unique_ptr<utf8::DataSource> open_stream(const char* file, const char* codepage) {
+		std::unique_ptr<utf8::FileDataSource> stream(new utf8::FileDataSource());
+		if (!stream->open(file)) {
+			return nullptr;
+		}
+
+		std::string stream_codepage = codepage ?: "";
+		if (stream_codepage.length() == 0) {
+			const auto detected = TextEncodingForStream(*stream);
+			if (detected.invalid()) {
+				return nullptr;
+			}
+			stream_codepage = detected.name;
+		}
+
+		if (ucnv_compareNames(stream_codepage.c_str(), "UTF-8") == 0) {
+			// Invalid sequences are replaced as the stream is parsed, as converting it would replace them
+			stream->validate = utf8::validation::Replace;
+			return stream;
+		}
+
+		utf16::ByteOrder order = utf16::LittleEndian;
+		if (IsUTF16(stream_codepage, order)) {
+			std::unique_ptr<utf16::FileDataSource> utf16(new utf16::FileDataSource());
+			if (utf16->open(std::move(stream), order)) {
+				return utf16;
+			}
+			return nullptr;
+		}
+
+		std::unique_ptr<TranscodingFileDataSource> transcoded(new TranscodingFileDataSource());
+		if (transcoded->open(std::move(stream), stream_codepage.c_str())) {
+			return transcoded;
+		}
+		return nullptr;
+	}
+
+	std::unique_ptr<utf8::DataSource> open_file(const char* file, const char* codepage) {
+		struct stat info;
+		if (::stat(file, &info) != 0) {
+			return nullptr;
+		}
+		if (!S_ISREG(info.st_mode)) {
+			return open_stream(file, codepage);
+		}
+
+		std::string file_codepage = codepage ?: "";
+		if (file_codepage.length() == 0) {
+			const auto detected = encoding::TextEncodingForFile(file);
+			if (detected.invalid()) {
+				return nullptr;
+			}
+			file_codepage = detected.name;
+		}
+
+		if (ucnv_compareNames(file_codepage.c_str(), "UTF-8") == 0) {
+			// Converting valid UTF-8 to UTF-8 would leave it unchanged, so it's parsed as is.  Rather than reading the
+			// whole file to check it first, invalid sequences are replaced as the file is parsed, as converting it
+			// would replace them
+			std::unique_ptr<utf8::MappedFileDataSource> mapped(new utf8::MappedFileDataSource());
+			if (mapped->open(file)) {
+				mapped->validate = utf8::validation::Replace;
+				return mapped;
+			}
+		}
+		else if (codepage::find(file_codepage.c_str()) != NULL) {
+			// Single byte codepages (including files that are only ASCII, which are detected as ISO-8859-1) are
+			// decoded by the built-in tables a block at a time, and blocks of ASCII are parsed as they are
+			std::unique_ptr<codepage::FileDataSource> decoded(new codepage::FileDataSource());
+			if (decoded->open(file, file_codepage.c_str())) {
+				return decoded;
+			}
+			return nullptr;
+		}
+
+		// UTF-16 is decoded directly.  A byte order mark at the start of the file overrides the codepage's byte order
+		utf16::ByteOrder order = utf16::LittleEndian;
+		if (IsUTF16(file_codepage, order)) {
+			std::unique_ptr<utf16::FileDataSource> utf16(new utf16::FileDataSource());
+			if (utf16->open(file, order)) {
+				return utf16;
+			}
+			return nullptr;
+		}
+
+		std::unique_ptr<TranscodingFileDataSource> transcoded(new TranscodingFileDataSource());
+		if (transcoded->open(file, file_codepage.c_str())) {
+			return transcoded;
+		}
+		return nullptr;
+	}
+
 	bool StringDataSource::set(const std::string& text, const char* codepage) {
 		std::string cp = codepage ?: "";
 		if (codepage == NULL) {
@@ -24,10 +24,16 @@
 
 #ifdef ALLOW_ICU_EXTENSIONS
 
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <vector>
+
 #include <csv/datasource/IDataSource.hpp>
+#include <csv/datasource/utf8/DataSource.hpp>
 
+#include <unicode/ucnv.h>
 #include <unicode/unistr.h>
-#include <unicode/ustdio.h>
 
 namespace csv {
 namespace icu {
@@ -39,10 +45,24 @@ namespace icu {
 		UChar32 separator = ',';
 		UChar32 comment = '\0';
 
-	protected:
-		virtual bool is_eol();
+	public:
 		virtual std::string field() const;
 
+		inline virtual bool is_eol() {
+			if (_current == '\r') {
+				if (next() == false) {
+					// Hit the end of file.  Return true and let the caller handle it
+					return true;
+				}
+
+				if (_current != '\n') {
+					back();
+				}
+				return true;
+			}
+			return _current == '\n';
+		}
+
 		inline virtual bool is_separator() const {
 			return _current == separator;
 		}
@@ -75,36 +95,209 @@ namespace icu {
 		U_ICU_NAMESPACE::UnicodeString _field;
 	};
 
-	class FileDataSource: public DataSource {
+	/// A file data source that decodes the file a character at a time.
+	///
+	/// The file is read into a buffer owned by the data source and decoded from it, so the progress reported is
+	/// the exact number of bytes of the file that have been decoded.
+	class FileDataSource final: public DataSource {
 	public:
-		FileDataSource() noexcept
-		: _in(NULL) {
-		}
+		FileDataSource() noexcept {}
 
 		/// Throws csv::file_exception if unable to open file or determine codepage
-		FileDataSource(const std::string& file, const char* codepage)
-		: _in(NULL) {
+		FileDataSource(const std::string& file, const char* codepage) {
 			if (!open(file.c_str(), codepage)) {
 				throw csv::file_exception();
 			}
 		}
 
+		FileDataSource(const FileDataSource&) = delete;
+		FileDataSource& operator=(const FileDataSource&) = delete;
+
 		bool open(const char* file, const char* codepage);
 		void close();
 
 		virtual ~FileDataSource();
 
-	protected:
+		/// If set, the number of bytes of the file decoded so far is stored here as the file is parsed, so that
+		/// another thread can poll the progress of the parse
+		std::atomic<size_t>* progressCounter = NULL;
+
+		/// The number of bytes of the file decoded so far
+		inline size_t consumed() const { return _end; }
+
+	public:
 		virtual bool next();
 		virtual void back();
 		virtual double progress();
 
 	private:
-		UFILE* _in;
-		long long _length;
+		/// Decode the next characters of the file.  Returns false if there are no more
+		bool decode();
+		/// The number of bytes of a partial character held by the converter
+		size_t pending() const;
+
+		std::ifstream _in;
+		size_t _length = 0;
+		UConverter* _converter = NULL;
+		bool _flushed = false;
+
+		// Data read from the file, the next byte to decode, and the offset of the buffer in the file
+		std::vector<char> _input;
+		const char* _source = NULL;
+		const char* _sourceLimit = NULL;
+		size_t _inputOffset = 0;
+		bool _inputEOF = false;
+
+		// The decoded UTF-16 units, the offset in the file following each of them, and the next unit
+		std::vector<UChar> _units;
+		std::vector<int32_t> _offsets;
+		std::vector<size_t> _ends;
+		size_t _unit = 0;
+		size_t _unitCount = 0;
+
+		// The offset of the end of the current (and previous) character in the file
+		size_t _end = 0;
+		size_t _prevEnd = 0;
+
+		// The character moved back over by back(), returned again by the next call to next()
+		bool _unread = false;
+		UChar32 _next = 0;
+		size_t _nextEnd = 0;
 	};
 
-	class StringDataSource: public DataSource {
+	/// A data source that converts data from its codepage to UTF-8 a block at a time, so that it is parsed by the
+	/// (block based) UTF-8 parser rather than a character at a time.  The data to convert is supplied by fill().
+	class TranscodingDataSource: public utf8::DataSource {
+	public:
+		virtual ~TranscodingDataSource();
+
+		TranscodingDataSource(const TranscodingDataSource&) = delete;
+		TranscodingDataSource& operator=(const TranscodingDataSource&) = delete;
+
+		/// If set, the number of bytes of the data converted so far is stored here as the data is parsed, so that
+		/// another thread can poll the progress of the parse.  It is updated a block at a time
+		std::atomic<size_t>* progressCounter = NULL;
+
+	public:
+		virtual csv::block read_block();
+		virtual double progress_at(size_t position) const;
+
+	protected:
+		TranscodingDataSource() noexcept {}
+
+		/// Open the converters for the codepage.  Returns false if the codepage isn't supported
+		bool open_converters(const char* codepage, size_t length);
+
+		/// Close the converters and reset the conversion
+		void close_converters();
+
+		/// Supply the next piece of data to convert, setting _source and _sourceLimit to it.  Sets _inputEOF
+		/// once the last piece has been supplied
+		virtual bool fill() = 0;
+
+		// Data to convert, and the next byte to convert
+		const char* _source = NULL;
+		const char* _sourceLimit = NULL;
+		bool _inputEOF = false;
+		size_t _inputRead = 0;
+
+	private:
+		// The length of the data being converted, for progress
+		size_t _length = 0;
+
+		// Converters from the codepage to UTF-16, and from UTF-16 to UTF-8
+		UConverter* _converter = NULL;
+		UConverter* _utf8 = NULL;
+		bool _reset = true;
+		bool _flushed = false;
+
+		// UTF-16 buffer between the converters
+		std::vector<UChar> _pivot;
+		UChar* _pivotSource = NULL;
+		UChar* _pivotTarget = NULL;
+
+		// UTF-8 output returned by read_block()
+		std::vector<char> _output;
+		bool _first = true;
+
+		// The positions of the current block, for progress
+		size_t _outputBefore = 0;
+		size_t _blockSize = 0;
+		size_t _inputBefore = 0;
+		size_t _inputAfter = 0;
+	};
+
+	/// A file data source that converts the file from its codepage to UTF-8 a block at a time
+	class TranscodingFileDataSource final: public TranscodingDataSource {
+	public:
+		TranscodingFileDataSource() noexcept {}
+		~TranscodingFileDataSource();
+
+		/// Throws csv::file_exception if unable to open file or determine codepage
+		TranscodingFileDataSource(const std::string& file, const char* codepage) {
+			if (!open(file.c_str(), codepage)) {
+				throw csv::file_exception();
+			}
+		}
+
+		/// Open a file.  If codepage is NULL the codepage is detected from the start of the file
+		bool open(const char* file, const char* codepage);
+		/// Convert a file (or stream) that has already been opened, and possibly sampled with peek().  If codepage
+		/// is NULL the codepage is detected from the start of the data, which is then converted from its start
+		bool open(std::unique_ptr<utf8::FileDataSource> stream, const char* codepage);
+		void close();
+
+	protected:
+		/// Read the next block of the file
+		virtual bool fill();
+
+	private:
+		std::ifstream _in;
+		// A pipe (or other stream) is read a block at a time as it arrives, rather than through _in
+		std::unique_ptr<utf8::FileDataSource> _stream;
+
+		// Data read from the file
+		std::vector<char> _input;
+	};
+
+	/// A string data source that converts the string from its codepage to UTF-8 a block at a time.  Unlike
+	/// StringDataSource, the string isn't converted to a UnicodeString first, so only the string (which can be
+	/// moved into the data source) and a block of the converted data are held in memory.
+	class TranscodingStringDataSource final: public TranscodingDataSource {
+	public:
+		TranscodingStringDataSource() noexcept {}
+
+		/// Throws csv::data_exception if the codepage can't be determined or isn't supported
+		TranscodingStringDataSource(std::string text, const char* codepage) {
+			if (!set(std::move(text), codepage)) {
+				throw csv::data_exception();
+			}
+		}
+
+		/// Set the string to parse.  If codepage is NULL the codepage is detected from samples of the string
+		bool set(std::string text, const char* codepage);
+
+	protected:
+		/// Supply the whole string
+		virtual bool fill();
+
+	private:
+		std::string _text;
+	};
+
+	/// Open a file for parsing.  If codepage is NULL the codepage is detected from the start of the file.
+	///
+	/// UTF-8 files don't need converting, so they are memory mapped and read directly by the UTF-8 parser.  The file
+	/// isn't checked before it's parsed -- instead its invalid sequences are replaced as they're parsed (see
+	/// utf8::validation::Replace), as converting the file would replace them.  Files in the single byte codepages
+	/// of codepage::find() (including ASCII files, which are detected as ISO-8859-1) are decoded by a
+	/// codepage::FileDataSource, UTF-16 files by a utf16::FileDataSource, and other files by a
+	/// TranscodingFileDataSource.  Pipes (and other streams) are only opened once -- their codepage is detected from
+	/// the start of the data, which is kept to be parsed, and UTF-8 streams are read by a utf8::FileDataSource.
+	/// Returns nullptr if the file can't be opened or its codepage can't be determined.
+	std::unique_ptr<utf8::DataSource> open_file(const char* file, const char* codepage);
+
+	class StringDataSource final: public DataSource {
 	public:
 		StringDataSource() noexcept : _offset(-1) {}
 		StringDataSource(const std::string& data, const char* codepage) {
@@ -115,7 +308,7 @@ namespace icu {
 
 		bool set(const std::string& text, const char* codepage);
 
-	protected:
+	public:
 		virtual bool next();
 		virtual void back();
 		virtual double progress();
@@ -10,8 +10,18 @@
 
 #ifdef ALLOW_ICU_EXTENSIONS
 
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
 #include "unicode/ucsdet.h"
 #include "unicode/uclean.h"
+#include "unicode/ucnv.h"
 
 namespace csv {
 namespace icu {
@@ -20,43 +30,196 @@ namespace encoding {
 	struct detected_language {
 		std::string name;
 		std::string language;
-		int32_t confidence;
+		int32_t confidence = 0;
 
 		bool invalid() const { return name.empty(); }
 	};
 
-	detected_language TextEncodingForData(const char* data, size_t length) {
-		UErrorCode uerr = U_ZERO_ERROR;
-		UCharsetDetector *ucd = ucsdet_open ( &uerr );
-		ucsdet_setText(ucd, data, static_cast<int>(length), &uerr);
-		UCharsetMatch const * match = ucsdet_detect(ucd, &uerr);
+	/// The encodings that the data could be in, from the most to the least likely
+	struct detected_candidates {
+		std::vector<detected_language> candidates;
+
+		bool invalid() const { return candidates.empty(); }
+
+		/// The most likely encoding (invalid if no encoding was detected)
+		detected_language best() const {
+			return candidates.empty() ? detected_language() : candidates.front();
+		}
+
+		/// The confidence (0 to 100) that the data is in the named encoding, or 0 if it isn't a candidate
+		int32_t confidence(const char* name) const {
+			for (const auto& candidate: candidates) {
+				if (ucnv_compareNames(candidate.name.c_str(), name) == 0) {
+					return candidate.confidence;
+				}
+			}
+			return 0;
+		}
+	};
+
+	/// Wraps an ICU charset detector so that it can be reused for each detection
+	class detector {
+	public:
+		detector() {
+			UErrorCode status = U_ZERO_ERROR;
+			_detector = ucsdet_open(&status);
+			if (U_FAILURE(status)) {
+				_detector = NULL;
+			}
+		}
+		~detector() {
+			if (_detector != NULL) {
+				ucsdet_close(_detector);
+			}
+		}
+
+		detector(const detector&) = delete;
+		detector& operator=(const detector&) = delete;
+
+		/// Returns every encoding the data could be in, along with the confidence in each
+		detected_candidates detect(const char* data, size_t length) {
+			detected_candidates detected;
+			if (_detector == NULL || length == 0) {
+				return detected;
+			}
+
+			UErrorCode status = U_ZERO_ERROR;
+			ucsdet_setText(_detector, data, static_cast<int32_t>(length), &status);
+			int32_t count = 0;
+			const UCharsetMatch** matches = ucsdet_detectAll(_detector, &count, &status);
+			if (U_FAILURE(status)) {
+				return detected;
+			}
+
+			// The matches belong to the detector, so they are copied before it is used again
+			for (int32_t index = 0; index < count; index++) {
+				UErrorCode matchStatus = U_ZERO_ERROR;
+				const char* name = ucsdet_getName(matches[index], &matchStatus);
+				const char* language = ucsdet_getLanguage(matches[index], &matchStatus);
+				if (U_SUCCESS(matchStatus) && name != NULL) {
+					detected_language candidate;
+					candidate.name = name;
+					candidate.language = language ?: "";
+					candidate.confidence = ucsdet_getConfidence(matches[index], &matchStatus);
+					detected.candidates.push_back(candidate);
+				}
+			}
+			return detected;
+		}
+
+		/// The detector for the calling thread
+		static detector& current() {
+			static thread_local detector instance;
+			return instance;
+		}
+
+	private:
+		UCharsetDetector* _detector = NULL;
+	};
+
+	inline detected_candidates CandidatesForData(const char* data, size_t length) {
+		return detector::current().detect(data, length);
+	}
+
+	inline detected_language TextEncodingForData(const char* data, size_t length) {
+		return CandidatesForData(data, length).best();
+	}
+
+	/// Trims a sample of the file to whole lines, so that the characters at either end aren't cut in half.
+	/// The start of the file (and its end) are always whole
+	inline void TrimSample(std::string& sample, bool start, bool end) {
+		if (!end) {
+			const size_t last = sample.rfind('\n');
+			if (last != std::string::npos && last > 0) {
+				sample.resize(last + 1);
+			}
+		}
+		if (!start) {
+			const size_t first = sample.find('\n');
+			if (first != std::string::npos && first + 1 < sample.size()) {
+				sample.erase(0, first + 1);
+			}
+		}
+	}
+
+	/// Joins samples of (up to) sampleSize bytes from the start, middle and end of data of the given length, each
+	/// returned by read(offset, size).  Data of up to three samples is read whole
+	template <typename Reader>
+	std::string SampleData(size_t length, size_t sampleSize, Reader read) {
+		if (length <= 3 * sampleSize) {
+			return read(0, length);
+		}
 
-		detected_language detected;
-		detected.name = ucsdet_getName(match, &uerr);
-		detected.language = ucsdet_getLanguage(match, &uerr);
-		detected.confidence = ucsdet_getConfidence(match, &uerr);
+		std::string samples = read(0, sampleSize);
+		if (memchr(samples.data(), '\0', samples.size()) != NULL) {
+			// Encodings containing NULs (UTF-16 and UTF-32) can't be cut at their line breaks, so only the start
+			// of the data is used
+			return samples;
+		}
+		TrimSample(samples, true, false);
 
-		ucsdet_close(ucd);
-		// u_cleanup(); // keep valgrind happy!!
+		const size_t offsets[2] = { length / 2 - sampleSize / 2, length - sampleSize };
+		for (int index = 0; index < 2; index++) {
+			std::string sample = read(offsets[index], sampleSize);
+			TrimSample(sample, false, index == 1);
+			samples += sample;
+		}
+		return samples;
+	}
 
-		return detected;
+	/// Detects the encoding of data from samples of (up to) sampleSize bytes from its start, middle and end,
+	/// rather than from all of it
+	inline detected_candidates SampledCandidatesForData(const char* data, size_t length, size_t sampleSize = 4096) {
+		if (sampleSize == 0) {
+			return detected_candidates();
+		}
+		const std::string samples = SampleData(length, sampleSize, [data](size_t offset, size_t size) {
+			return std::string(data + offset, size);
+		});
+		return CandidatesForData(samples.data(), samples.size());
 	}
 
-	detected_language TextEncodingForFile(const char* file) {
-		UErrorCode u_glob_status = U_ZERO_ERROR;
-		FILE* fp(0);
+	/// Detects the encoding of a file from samples of (up to) sampleSize bytes from its start, middle and end.
+	/// A file whose start is in an ASCII compatible encoding but only contains ASCII (a header, for example)
+	/// is then detected from the text further into the file
+	inline detected_candidates CandidatesForFile(const char* file, size_t sampleSize = 4096) {
+		static const bool initialized = []() {
+			UErrorCode status = U_ZERO_ERROR;
+			u_init(&status);
+			return U_SUCCESS(status);
+		}();
+		if (!initialized || sampleSize == 0) {
+			return detected_candidates();
+		}
 
-		u_init(&u_glob_status);
-		if (U_SUCCESS(u_glob_status) &&
-			(fp = fopen(file, "rb")) != NULL) {
-			// Read (up to) the first 4k.  It should give us enough to detect the file
-			char buf[4096];
-			size_t read = fread(buf, 1, 4096, fp);
+		const int fd = ::open(file, O_RDONLY);
+		if (fd < 0) {
+			return detected_candidates();
+		}
 
-			fclose(fp);
-			return TextEncodingForData(buf, read);
+		std::string samples;
+		struct stat info;
+		if (::fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+			samples = SampleData(static_cast<size_t>(info.st_size), sampleSize, [fd](size_t offset, size_t size) {
+				std::string sample(size, '\0');
+				const ssize_t count = ::pread(fd, &sample[0], size, static_cast<off_t>(offset));
+				sample.resize(count > 0 ? static_cast<size_t>(count) : 0);
+				return sample;
+			});
+		}
+		else {
+			// Pipes are only sampled from their start
+			samples.resize(sampleSize);
+			const ssize_t count = ::read(fd, &samples[0], sampleSize);
+			samples.resize(count > 0 ? static_cast<size_t>(count) : 0);
 		}
-		return detected_language();
+		::close(fd);
+
+		return CandidatesForData(samples.data(), samples.size());
+	}
+
+	inline detected_language TextEncodingForFile(const char* file) {
+		return CandidatesForFile(file).best();
 	}
 
 };
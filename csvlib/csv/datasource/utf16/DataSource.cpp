@@ -0,0 +1,383 @@
+//
+//  DataSource.cpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <algorithm>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "DataSource.hpp"
+
+#include <csv/structural.hpp>
+
+namespace csv {
+namespace utf16 {
+
+	/// The number of bytes of the file decoded at a time
+	static const size_t DECODE_BLOCK_SIZE = 1024 * 1024;
+
+namespace {
+
+	template <bool BigEndian>
+	inline uint16_t unit_at(const unsigned char* data) {
+		return BigEndian ? static_cast<uint16_t>((data[0] << 8) | data[1])
+						 : static_cast<uint16_t>(data[0] | (data[1] << 8));
+	}
+
+	/// Write a code point from the basic multilingual plane as UTF-8
+	inline void encode_bmp(uint16_t unit, char*& out) {
+		if (unit < 0x80) {
+			*out++ = static_cast<char>(unit);
+		}
+		else if (unit < 0x800) {
+			*out++ = static_cast<char>(0xC0 | (unit >> 6));
+			*out++ = static_cast<char>(0x80 | (unit & 0x3F));
+		}
+		else {
+			*out++ = static_cast<char>(0xE0 | (unit >> 12));
+			*out++ = static_cast<char>(0x80 | ((unit >> 6) & 0x3F));
+			*out++ = static_cast<char>(0x80 | (unit & 0x3F));
+		}
+	}
+
+	inline void encode_replacement(char*& out) {
+		encode_bmp(0xFFFD, out);
+	}
+
+	/// Convert whole blocks of code units that don't contain surrogates.  Returns the number of bytes consumed,
+	/// stopping at the first block containing a surrogate (or that is incomplete)
+	template <bool BigEndian>
+	inline size_t convert_blocks(const unsigned char* data, size_t size, char*& out) {
+		size_t index = 0;
+#if defined(CSV_STRUCTURAL_AVX2)
+		const __m256i asciiMask = _mm256_set1_epi16(static_cast<short>(0xFF80));
+		const __m256i surrogateMask = _mm256_set1_epi16(static_cast<short>(0xF800));
+		const __m256i surrogate = _mm256_set1_epi16(static_cast<short>(0xD800));
+		for (; index + 32 <= size; index += 32) {
+			__m256i units = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + index));
+			if (BigEndian) {
+				units = _mm256_or_si256(_mm256_slli_epi16(units, 8), _mm256_srli_epi16(units, 8));
+			}
+			if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(units, asciiMask), _mm256_setzero_si256())) == -1) {
+				// All ASCII.  Narrow each unit to a byte (packing works within each 128 bit lane)
+				const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(units, units), 0xD8);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm256_castsi256_si128(packed));
+				out += 16;
+				continue;
+			}
+			if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_and_si256(units, surrogateMask), surrogate)) != 0) {
+				break;
+			}
+			uint16_t values[16];
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(values), units);
+			for (size_t unit = 0; unit < 16; unit++) {
+				encode_bmp(values[unit], out);
+			}
+		}
+#elif defined(CSV_STRUCTURAL_SSE2)
+		const __m128i asciiMask = _mm_set1_epi16(static_cast<short>(0xFF80));
+		const __m128i surrogateMask = _mm_set1_epi16(static_cast<short>(0xF800));
+		const __m128i surrogate = _mm_set1_epi16(static_cast<short>(0xD800));
+		for (; index + 16 <= size; index += 16) {
+			__m128i units = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + index));
+			if (BigEndian) {
+				units = _mm_or_si128(_mm_slli_epi16(units, 8), _mm_srli_epi16(units, 8));
+			}
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(units, asciiMask), _mm_setzero_si128())) == 0xFFFF) {
+				// All ASCII.  Narrow each unit to a byte
+				_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(units, units));
+				out += 8;
+				continue;
+			}
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(units, surrogateMask), surrogate)) != 0) {
+				break;
+			}
+			uint16_t values[8];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(values), units);
+			for (size_t unit = 0; unit < 8; unit++) {
+				encode_bmp(values[unit], out);
+			}
+		}
+#elif defined(CSV_STRUCTURAL_NEON)
+		for (; index + 16 <= size; index += 16) {
+			uint8x16_t bytes = vld1q_u8(data + index);
+			if (BigEndian) {
+				bytes = vrev16q_u8(bytes);
+			}
+			const uint16x8_t units = vreinterpretq_u16_u8(bytes);
+			if (vmaxvq_u16(units) < 0x80) {
+				// All ASCII.  Narrow each unit to a byte
+				vst1_u8(reinterpret_cast<uint8_t*>(out), vmovn_u16(units));
+				out += 8;
+				continue;
+			}
+			if (vmaxvq_u16(vceqq_u16(vandq_u16(units, vdupq_n_u16(0xF800)), vdupq_n_u16(0xD800))) != 0) {
+				break;
+			}
+			uint16_t values[8];
+			vst1q_u16(values, units);
+			for (size_t unit = 0; unit < 8; unit++) {
+				encode_bmp(values[unit], out);
+			}
+		}
+#endif
+		return index;
+	}
+
+	/// Convert the complete characters in the data, returning the number of bytes consumed.  If 'last' is set
+	/// all of the data is consumed, replacing an incomplete character at the end with U+FFFD
+	template <bool BigEndian>
+	size_t convert(const unsigned char* data, size_t size, char*& out, bool last) {
+		size_t index = 0;
+		while (index + 2 <= size) {
+			index += convert_blocks<BigEndian>(data + index, size - index, out);
+			if (index + 2 > size) {
+				break;
+			}
+
+			const uint16_t unit = unit_at<BigEndian>(data + index);
+			if ((unit & 0xF800) != 0xD800) {
+				encode_bmp(unit, out);
+				index += 2;
+			}
+			else if (unit <= 0xDBFF) {
+				// A high surrogate, which must be followed by a low surrogate
+				if (index + 4 > size) {
+					if (!last) {
+						break;
+					}
+					// Cut short by the end of the data (along with any odd byte following it)
+					encode_replacement(out);
+					index = size;
+					break;
+				}
+				const uint16_t low = unit_at<BigEndian>(data + index + 2);
+				if ((low & 0xFC00) != 0xDC00) {
+					encode_replacement(out);
+					index += 2;
+					continue;
+				}
+				const uint32_t code = 0x10000 + ((static_cast<uint32_t>(unit) - 0xD800) << 10) + (low - 0xDC00);
+				*out++ = static_cast<char>(0xF0 | (code >> 18));
+				*out++ = static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+				*out++ = static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+				*out++ = static_cast<char>(0x80 | (code & 0x3F));
+				index += 4;
+			}
+			else {
+				// A low surrogate without a high surrogate
+				encode_replacement(out);
+				index += 2;
+			}
+		}
+
+		if (last && index < size) {
+			// A single byte left over
+			encode_replacement(out);
+			index = size;
+		}
+		return index;
+	}
+
+	size_t convert(ByteOrder order, const unsigned char* data, size_t size, char*& out, bool last) {
+		return (order == BigEndian) ? convert<true>(data, size, out, last)
+									: convert<false>(data, size, out, last);
+	}
+};
+
+	void decoder::set_order(ByteOrder order) {
+		_order = order;
+		_pendingSize = 0;
+	}
+
+	size_t decoder::decode(const char* data, size_t size, char* out, bool last) {
+		char* const start = out;
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+
+		if (_pendingSize > 0) {
+			// Complete the character held from the previous data.  A partial character is at most 3 bytes, so
+			// another 4 bytes is always enough to consume it
+			unsigned char joined[8];
+			const size_t count = std::min<size_t>(size, 4);
+			memcpy(joined, _pending, _pendingSize);
+			memcpy(joined + _pendingSize, bytes, count);
+			const size_t total = _pendingSize + count;
+			const size_t consumed = convert(_order, joined, total, out, last && count == size);
+			if (consumed < _pendingSize) {
+				// Still incomplete, so all of the data is held
+				memmove(_pending, joined + consumed, total - consumed);
+				_pendingSize = total - consumed;
+				return out - start;
+			}
+			bytes += consumed - _pendingSize;
+			size -= consumed - _pendingSize;
+			_pendingSize = 0;
+		}
+
+		const size_t consumed = convert(_order, bytes, size, out, last);
+		_pendingSize = size - consumed;
+		memcpy(_pending, bytes + consumed, _pendingSize);
+		return out - start;
+	}
+
+	FileDataSource::~FileDataSource() {
+		close();
+	}
+
+	bool FileDataSource::open(const char* file, ByteOrder order) {
+
+		// Close if we have one open already
+		close();
+
+		struct stat info;
+		if (::stat(file, &info) == 0 && !S_ISREG(info.st_mode)) {
+			// A pipe (or other stream) is read as the data arrives
+			std::unique_ptr<utf8::FileDataSource> stream(new utf8::FileDataSource());
+			return stream->open(file) && open(std::move(stream), order);
+		}
+
+		_in.open(file, std::ifstream::in | std::ifstream::binary);
+		if (!_in.is_open()) {
+			close();
+			return false;
+		}
+		_in.seekg(0, std::ios::end);
+		_length = _in.tellg();
+		if (_length < 0) {
+			_length = 0;
+		}
+		_in.clear();
+		_in.seekg(0, std::ios::beg);
+
+		// Check for a byte order mark.  Anything else read is held for the first block
+		char bom[2];
+		_in.read(bom, 2);
+		_head.assign(bom, static_cast<size_t>(_in.gcount()));
+		if (set_order(_head, order)) {
+			_head.clear();
+		}
+		return true;
+	}
+
+	bool FileDataSource::open(std::unique_ptr<utf8::FileDataSource> stream, ByteOrder order) {
+
+		// Close if we have one open already
+		close();
+		if (!stream) {
+			return false;
+		}
+
+		_stream = std::move(stream);
+		_length = _stream->has_length() ? static_cast<long long>(_stream->length()) : 0;
+
+		// The start of the stream is read ahead to check for a byte order mark, and the mark skipped in the first block
+		const csv::block start = _stream->peek(2);
+		if (set_order(std::string(start.data, start.size), order)) {
+			_skip = _bomSize;
+		}
+		return true;
+	}
+
+	bool FileDataSource::set_order(const std::string& start, ByteOrder order) {
+		bool found = false;
+		if (start == "\xFF\xFE") {
+			order = LittleEndian;
+			found = true;
+		}
+		else if (start == "\xFE\xFF") {
+			order = BigEndian;
+			found = true;
+		}
+		_bomSize = found ? 2 : 0;
+
+		_decoder.set_order(order);
+		_inputAfter = _bomSize;
+		_input.resize(DECODE_BLOCK_SIZE);
+		_output.resize(decoder::max_output(DECODE_BLOCK_SIZE));
+		return found;
+	}
+
+	void FileDataSource::close() {
+		reset();
+		if (_in.is_open()) {
+			_in.close();
+		}
+		_in.clear();
+		_stream.reset();
+		_skip = 0;
+		_decoder.set_order(LittleEndian);
+		_length = 0;
+		_bomSize = 0;
+		_head.clear();
+		_eof = false;
+		_outputBefore = _blockSize = 0;
+		_inputBefore = _inputAfter = 0;
+	}
+
+	csv::block FileDataSource::read_block() {
+		_outputBefore += _blockSize;
+		_inputBefore = _inputAfter;
+		_blockSize = 0;
+
+		if ((!_in.is_open() && !_stream) || _eof) {
+			return csv::block(NULL, 0, true);
+		}
+
+		if (_stream) {
+			// Decode whatever has arrived
+			const csv::block block = _stream->read_block();
+			const size_t skip = std::min(_skip, block.size);
+			_skip = 0;
+			_eof = block.eof;
+			_blockSize = _decoder.decode(block.data + skip, block.size - skip, _output.data(), _eof);
+			_inputAfter += block.size - skip;
+			return csv::block(_output.data(), _blockSize, _eof);
+		}
+
+		size_t count = _head.size();
+		memcpy(_input.data(), _head.data(), count);
+		_head.clear();
+
+		_in.read(_input.data() + count, static_cast<std::streamsize>(_input.size() - count));
+		count += static_cast<size_t>(_in.gcount());
+		_eof = (count < _input.size());
+
+		_blockSize = _decoder.decode(_input.data(), count, _output.data(), _eof);
+		_inputAfter += count;
+		return csv::block(_output.data(), _blockSize, _eof);
+	}
+
+	double FileDataSource::progress_at(size_t position) const {
+		if (_length <= 0) {
+			// The length of a stream isn't known, so the progress is only known once the end has been read
+			return _eof ? 1.0 : 0.0;
+		}
+
+		// Interpolate the position within the current block to the bytes of the file it was decoded from
+		double pos = _inputBefore;
+		if (_blockSize > 0 && position > _outputBefore) {
+			const double fraction = static_cast<double>(position - _outputBefore) / _blockSize;
+			pos += std::min(fraction, 1.0) * (_inputAfter - _inputBefore);
+		}
+		double len = _length;
+		return std::min(pos / len, 1.0);
+	}
+};
+};
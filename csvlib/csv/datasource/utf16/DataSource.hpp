@@ -0,0 +1,137 @@
+//
+//  DataSource.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+// UTF-16 data, decoded to UTF-8 in blocks so that it can be parsed by the UTF-8 parser (without ICU).
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <csv/datasource/utf8/DataSource.hpp>
+
+namespace csv {
+namespace utf16 {
+
+	enum ByteOrder {
+		LittleEndian,
+		BigEndian
+	};
+
+	/// Decodes UTF-16 to UTF-8.
+	///
+	/// Runs of ASCII are converted a block at a time, as are blocks without surrogates.  A code unit or surrogate
+	/// pair split between calls to decode() is held until the rest of it arrives.  Unpaired surrogates (and an odd
+	/// byte at the end of the data) are replaced with U+FFFD.
+	class decoder {
+	public:
+		decoder(ByteOrder order = LittleEndian) noexcept : _order(order) {}
+
+		/// The byte order of the data
+		inline ByteOrder order() const { return _order; }
+		/// Change the byte order of the data, discarding any partial character held from the previous data
+		void set_order(ByteOrder order);
+
+		/// The number of bytes of output required to decode 'size' bytes
+		static inline size_t max_output(size_t size) {
+			return ((size + 4) / 2) * 3;
+		}
+
+		/// Decode 'size' bytes of data to UTF-8, returning the number of bytes written to 'out', which must have room
+		/// for max_output(size) bytes.  Set 'last' for the final piece of the data
+		size_t decode(const char* data, size_t size, char* out, bool last);
+
+	private:
+		ByteOrder _order;
+
+		// The bytes of a partial character at the end of the previous data
+		unsigned char _pending[4];
+		size_t _pendingSize = 0;
+	};
+
+	/// A UTF-16 file, decoded to UTF-8 a block at a time.
+	///
+	/// The byte order is determined by the byte order mark at the start of the file (which is skipped).  If there isn't
+	/// one, the byte order passed to open() is used.  Pipes can be read too, in which case the progress reported is
+	/// 0 until the end of the data has been read
+	class FileDataSource final: public utf8::DataSource {
+	public:
+		FileDataSource() noexcept {}
+		~FileDataSource();
+
+		FileDataSource(const FileDataSource&) = delete;
+		FileDataSource& operator=(const FileDataSource&) = delete;
+
+		/// Throws csv::file_exception if unable to open file
+		FileDataSource(const char* file, ByteOrder order = LittleEndian) {
+			if (!open(file, order)) {
+				throw csv::file_exception();
+			}
+		}
+
+		/// Open a file.  'order' is the byte order of the file if it doesn't start with a byte order mark
+		bool open(const char* file, ByteOrder order = LittleEndian);
+		/// Decode a file (or stream) that has already been opened, and possibly sampled with peek()
+		bool open(std::unique_ptr<utf8::FileDataSource> stream, ByteOrder order = LittleEndian);
+		void close();
+
+		/// The byte order of the open file
+		inline ByteOrder order() const { return _decoder.order(); }
+		/// Did the file start with a byte order mark?
+		inline bool has_bom() const { return _bomSize > 0; }
+
+	public:
+		virtual csv::block read_block();
+		virtual double progress_at(size_t position) const;
+
+	private:
+		/// Set the byte order from the byte order mark at the start of the file, if it has one, and allocate the
+		/// buffers.  Returns true if there is a byte order mark
+		bool set_order(const std::string& start, ByteOrder order);
+
+		decoder _decoder;
+
+		std::ifstream _in;
+		long long _length = 0;
+		size_t _bomSize = 0;
+		// Bytes read while checking for a byte order mark, returned by the first block
+		std::string _head;
+
+		// A pipe (or other stream) is read a block at a time as it arrives, rather than through _in.  The byte
+		// order mark is skipped at the start of its first block
+		std::unique_ptr<utf8::FileDataSource> _stream;
+		size_t _skip = 0;
+
+		// Data read from the file, and the UTF-8 it was decoded to
+		std::vector<char> _input;
+		std::vector<char> _output;
+		bool _eof = false;
+
+		// The positions of the current block, for progress
+		size_t _outputBefore = 0;
+		size_t _blockSize = 0;
+		size_t _inputBefore = 0;
+		size_t _inputAfter = 0;
+	};
+};
+};
@@ -21,9 +21,13 @@
 //  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 //
 
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
-#include <limits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <array>
 
 #include "DataSource.hpp"
@@ -37,26 +41,210 @@ namespace utf8 {
 	static const std::string _BOMS = { '\xEF', '\xBB', '\xBF' };
 	static const size_t _BOMS_SIZE = 3;
 
+	// The size of the blocks read from files
+	static const size_t _BLOCK_SIZE = 64 * 1024;
+
+	// The size of the slices a large block (eg. a memory mapped file) is validated in
+	static const size_t _VALIDATION_SLICE_SIZE = 1024 * 1024;
+
 	DataSource::DataSource() noexcept {
 		_field.reserve(256);
 	}
 
-	bool DataSource::is_eol() {
-		if (_current == '\r') {
-			if (next() == false) {
-				// Hit the end of file.  Return true and let the caller handle it
+	void DataSource::reset() {
+		_prev = 0;
+		_current = 0;
+		_begin = _cursor = _end = NULL;
+		_eof = false;
+		_consumed = 0;
+		_replay = false;
+
+		invalid = validation::location();
+		_offset = 0;
+		_tail.clear();
+		_hasRest = false;
+		_hasUnchecked = false;
+		_locating = false;
+		_failed = false;
+	}
+
+	bool DataSource::fill() {
+		while (!_eof) {
+			_consumed += (_end - _begin);
+
+			const csv::block block = read_block();
+			_begin = _cursor = block.data;
+			_end = block.data + block.size;
+			_eof = block.eof;
+
+			if (block.size > 0) {
 				return true;
 			}
+		}
+		return false;
+	}
+
+	csv::block DataSource::next_block(size_t row, size_t column) {
+		if (validate == validation::Unchecked) {
+			return read_block();
+		}
+
+		if (_locating) {
+			// The previous block ended at the first invalid sequence, so the parser is positioned at it
+			_locating = false;
+			invalid.row = row;
+			invalid.column = column;
+			_failed = (validate == validation::Fail);
+		}
+		if (_failed) {
+			return csv::block(NULL, 0, true);
+		}
+		if (_hasRest) {
+			_hasRest = false;
+			return _rest;
+		}
+
+		csv::block block;
+		if (_hasUnchecked) {
+			_hasUnchecked = false;
+			block = _unchecked;
+		}
+		else {
+			block = read_block();
+		}
+		if (block.size > _VALIDATION_SLICE_SIZE) {
+			// Validate a large block a slice at a time, so that parsing starts without reading all of it first
+			_unchecked = csv::block(block.data + _VALIDATION_SLICE_SIZE, block.size - _VALIDATION_SLICE_SIZE, block.eof);
+			_hasUnchecked = true;
+			block = csv::block(block.data, _VALIDATION_SLICE_SIZE, false);
+		}
+		const size_t offset = _offset;
+		_offset += block.size;
+
+		if (validate == validation::Replace) {
+			return replace_invalid(block, offset);
+		}
+		if (invalid.found) {
+			// Only the first invalid sequence is reported
+			return block;
+		}
 
-			if (_current != '\n') {
-				back();
+		size_t start = 0;
+		if (!_tail.empty()) {
+			// Complete the sequence that started at the end of the previous block
+			const size_t held = _tail.size();
+			_tail.append(block.data, std::min<size_t>(block.size, 3));
+			const validation::sequence checked = validation::check_sequence(_tail.data(), _tail.size());
+			if (checked.valid) {
+				start = checked.length - held;
+				_tail.clear();
+			}
+			else if (checked.truncated && !block.eof) {
+				// The whole block is part of the sequence
+				return block;
+			}
+			else {
+				// The sequence is in the data the parser has consumed, so it is positioned at it already
+				_tail.clear();
+				invalid.found = true;
+				invalid.offset = offset - held;
+				invalid.row = row;
+				invalid.column = column;
+				if (validate == validation::Fail) {
+					_failed = true;
+					return csv::block(NULL, 0, true);
+				}
+				return block;
 			}
-			return true;
 		}
-		else if (_current == '\n') {
-			return true;
+
+		const size_t valid = start + validation::valid_length(block.data + start, block.size - start);
+		if (valid < block.size) {
+			const validation::sequence checked = validation::check_sequence(block.data + valid, block.size - valid);
+			if (checked.truncated && !block.eof) {
+				// Cut short by the end of the block.  The next block should complete it
+				_tail.assign(block.data + valid, block.size - valid);
+			}
+			else {
+				invalid.found = true;
+				invalid.offset = offset + valid;
+				_locating = true;
+				_rest = csv::block(block.data + valid, block.size - valid, block.eof);
+				_hasRest = true;
+				return csv::block(block.data, valid, false);
+			}
 		}
-		return false;
+		return block;
+	}
+
+	csv::block DataSource::replace_invalid(const csv::block& block, size_t offset) {
+		const char* data = block.data;
+		const size_t size = block.size;
+
+		// Complete the sequence cut short by the end of the previous block, which continues into (at most) the first
+		// three bytes of this block.  As the bytes held start a valid sequence, the sequence (or invalid subpart)
+		// checked covers all of them
+		size_t start = 0;
+		size_t first = std::string::npos;
+		bool replaced = false;
+		_head.clear();
+		if (!_tail.empty()) {
+			const size_t held = _tail.size();
+			_tail.append(data, std::min<size_t>(size, 3));
+			const validation::sequence checked = validation::check_sequence(_tail.data(), _tail.size());
+			if (checked.truncated && !block.eof) {
+				// The whole block is part of the sequence
+				return csv::block(data, 0, false);
+			}
+			if (checked.valid) {
+				_head.assign(_tail, 0, checked.length);
+			}
+			else {
+				replaced = true;
+				if (!invalid.found) {
+					invalid.found = true;
+					invalid.offset = offset - held;
+					first = 0;
+				}
+				_head.assign("\xEF\xBF\xBD", 3);
+			}
+			start = checked.length - held;
+			_tail.clear();
+		}
+
+		const size_t index = start + validation::valid_length(data + start, size - start);
+		if (!replaced && (index == size || (!block.eof && validation::check_sequence(data + index, size - index).truncated))) {
+			// Nothing to replace, so the block is returned as it is, less an incomplete sequence at its end, which
+			// is held until the next block completes it
+			_tail.assign(data + index, size - index);
+			if (_head.empty()) {
+				return csv::block(data, index, block.eof);
+			}
+			_rest = csv::block(data + start, index - start, block.eof);
+			_hasRest = true;
+			return csv::block(_head.data(), _head.size(), false);
+		}
+
+		// Copy the block, replacing each invalid sequence.  The data from 'index' starts with an invalid sequence
+		// unless it's cut short by the end of the block, in which case the next block should complete it
+		_repaired.assign(_head);
+		_repaired.append(data + start, index - start);
+		const size_t used = validation::replace(data + index, size - index, block.eof, _repaired);
+		if (used > 0 && !invalid.found) {
+			invalid.found = true;
+			invalid.offset = offset + index;
+			first = _head.size() + (index - start);
+		}
+		_tail.assign(data + index + used, size - index - used);
+
+		if (first != std::string::npos) {
+			// End the block at the first replacement, to locate it
+			_locating = true;
+			_rest = csv::block(_repaired.data() + first, _repaired.size() - first, block.eof);
+			_hasRest = true;
+			return csv::block(_repaired.data(), first, false);
+		}
+		return csv::block(_repaired.data(), _repaired.size(), block.eof);
 	}
 };
 };
@@ -71,8 +259,9 @@ namespace utf8 {
 	}
 
 	void FileDataSource::close() {
-		if (_in.is_open()) {
-			_in.close();
+		if (_fd >= 0) {
+			::close(_fd);
+			_fd = -1;
 		}
 	}
 
@@ -80,55 +269,198 @@ namespace utf8 {
 
 		// If we have one open, close it first
 		close();
+		reset();
+		_eof = false;
+		_bytesRead = 0;
+		_length = 0;
+		_hasLength = false;
+		_bomSize = 0;
+		_checkBOM = false;
+		_first = true;
+		_peeked = 0;
+
+		_fd = ::open(file, O_RDONLY);
+		if (_fd < 0) {
+			return false;
+		}
+		_path = file;
+
+		struct stat info;
+		if (::fstat(_fd, &info) != 0) {
+			close();
+			return false;
+		}
+
+		if (!S_ISREG(info.st_mode)) {
+			// A pipe or other stream.  The length is unknown and we can't seek back after checking for
+			// a BOM, so check the first block read instead.
+			_checkBOM = true;
+			return true;
+		}
 
-		_in.open(file, std::ios::in | std::ios::binary);
-		if (_in.is_open()) {
+		// Get the size
+		_length = static_cast<std::streamsize>(info.st_size);
+		_hasLength = true;
 
-			// Get the size
-			_in.ignore( std::numeric_limits<std::streamsize>::max() );
-			_length = _in.gcount();
-			_in.clear();   //  Since ignore will have set eof.
-			_in.seekg( 0, std::ios_base::beg );
+		if (_length < static_cast<std::streamsize>(_BOMS_SIZE)) {
+			// If we have less chars in the file than the size of the BOM.
+			return true;
+		}
 
-			if (_length < _BOMS_SIZE) {
-				// If we have less chars in the file than the size of the BOM.
-				return true;
+		// Check if we have a BOM - Read the first three bytes.  The file is still read from its start, and the BOM
+		// is skipped in the first block
+		std::array<char, _BOMS_SIZE> utf8BOM;
+		std::fill(utf8BOM.begin(), utf8BOM.end(), 0);
+		if (::pread(_fd, utf8BOM.data(), utf8BOM.size(), 0) == static_cast<ssize_t>(_BOMS_SIZE) &&
+			memcmp(_BOMS.c_str(), utf8BOM.data(), _BOMS_SIZE) == 0) {
+			_bomSize = _BOMS_SIZE;
+		}
+		return true;
+	}
+
+	csv::block FileDataSource::peek(size_t size) {
+		if (_fd < 0 || !_first) {
+			return csv::block();
+		}
+		_buffer.resize(_BLOCK_SIZE);
+		size = std::min(size, _buffer.size());
+		_peeked = fill(_peeked, size);
+
+		// More than was asked for may have been read, which is kept too
+		return csv::block(_buffer.data(), std::min(size, _peeked), _eof && _peeked <= size);
+	}
+
+	size_t FileDataSource::fill(size_t count, size_t minimum) {
+		while (count < minimum && !_eof) {
+			const ssize_t result = ::read(_fd, _buffer.data() + count, _buffer.size() - count);
+			if (result < 0 && errno == EINTR) {
+				continue;
+			}
+			if (result <= 0) {
+				_eof = true;
+				break;
 			}
+			count += static_cast<size_t>(result);
+			_bytesRead += static_cast<size_t>(result);
+		}
+		return count;
+	}
 
-			// Check if we have a BOM - Read the first three bytes.
-			std::array<char, _BOMS_SIZE> utf8BOM;
-			std::fill(utf8BOM.begin(), utf8BOM.end(), 0);
-			_in.read(utf8BOM.data(), utf8BOM.size());
+	csv::block FileDataSource::read_block() {
+		if (_fd < 0 || (_eof && _peeked == 0)) {
+			return csv::block();
+		}
 
-			if (memcmp(_BOMS.c_str(), utf8BOM.data(), _BOMS_SIZE) != 0) {
-				_in.clear();					// clear fail and eof bits
-				_in.seekg(0, std::ios::beg);	// back to the start!
+		// A file is read a whole buffer at a time, so a short read means that we've hit the end of the file.  A
+		// stream returns whatever has arrived so far (without waiting for the buffer to fill), so that the records
+		// already written to it can be parsed.  Its end is only known when a read returns nothing
+		_buffer.resize(_BLOCK_SIZE);
+		const size_t minimum = _hasLength ? _buffer.size() : (_checkBOM ? _BOMS_SIZE : 1);
+		const size_t count = fill(_peeked, minimum);
+		_peeked = 0;
+
+		size_t offset = 0;
+		if (_first) {
+			_first = false;
+			if (_checkBOM && count >= _BOMS_SIZE && memcmp(_BOMS.c_str(), _buffer.data(), _BOMS_SIZE) == 0) {
+				_bomSize = _BOMS_SIZE;
 			}
+			_checkBOM = false;
+			offset = _bomSize;
 		}
 
-		return _in.is_open();
+		return csv::block(_buffer.data() + offset, count - offset, _eof);
 	}
 
-	double FileDataSource::progress() {
-		double pos = _in.tellg();
+	double FileDataSource::progress_at(size_t position) const {
+		if (!_hasLength) {
+			// Unknown length, so the progress is only known once the end has been read (see bytes_read())
+			return _eof ? 1.0 : 0.0;
+		}
+		double pos = position + _bomSize;
 		double len = _length;
 		return std::min(pos / len, 1.0);
 	}
+};
+
+// MARK: - UTF8 mapped file source
+
+namespace utf8 {
+
+	MappedFileDataSource::~MappedFileDataSource() {
+		close();
+	}
+
+	void MappedFileDataSource::close() {
+		if (_data != NULL) {
+			::munmap(const_cast<char*>(_data), _length);
+			_data = NULL;
+		}
+		_length = 0;
+	}
+
+	bool MappedFileDataSource::open(const char* file) {
+
+		// If we have one open, close it first
+		close();
+		reset();
+		_bomSize = 0;
+		_read = false;
+
+		const int fd = ::open(file, O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
 
-	bool FileDataSource::next() {
-		if (_in.peek() == EOF) {
+		struct stat info;
+		if (::fstat(fd, &info) != 0) {
+			::close(fd);
 			return false;
 		}
 
-		_prev = _current;
-		_in.get(_current);
+		_length = static_cast<size_t>(info.st_size);
+		if (_length == 0) {
+			// Nothing to map
+			::close(fd);
+			return true;
+		}
+
+		void* data = ::mmap(NULL, _length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		// The mapping remains valid once the file is closed
+		::close(fd);
+
+		if (data == MAP_FAILED) {
+			_length = 0;
+			return false;
+		}
+
+		// The file is read from start to end
+		::madvise(data, _length, MADV_SEQUENTIAL);
+		_data = static_cast<const char*>(data);
+
+		// Skip the BOM if there is one
+		if (_length >= _BOMS_SIZE && memcmp(_BOMS.c_str(), _data, _BOMS_SIZE) == 0) {
+			_bomSize = _BOMS_SIZE;
+		}
+
 		return true;
 	}
 
-	void FileDataSource::back() {
-		_current = _prev;
-		_prev = 0;
-		_in.unget();
+	csv::block MappedFileDataSource::read_block() {
+		if (_read || _data == NULL) {
+			return csv::block();
+		}
+
+		// The entire file is a single block
+		_read = true;
+		return csv::block(_data + _bomSize, _length - _bomSize, true);
+	}
+
+	double MappedFileDataSource::progress_at(size_t position) const {
+		double pos = position + _bomSize;
+		double len = _length;
+		return std::min(pos / len, 1.0);
 	}
 };
 
@@ -137,9 +469,10 @@ namespace utf8 {
 namespace utf8 {
 
 	bool StringDataSource::set(const std::string& data) {
+		reset();
 		_in = data;
-		_offset = -1;
-		_prev = 0;
+		_offset = 0;
+		_read = false;
 
 		// Check for a BOM and skip it
 		if (data.length() < _BOMS.size()) {
@@ -149,34 +482,26 @@ namespace utf8 {
 
 		if (memcmp(data.c_str(), _BOMS.c_str(), _BOMS.size()) == 0) {
 			// We have a BOM. Set the starting offset to AFTER it
-			// (note that the string offset starts at -1, so we need to set offset to 3 - 1)
-			_offset = 2;
+			_offset = _BOMS.size();
 		}
 
 		return true;
 	}
 
-	double StringDataSource::progress() {
-		double pos = _offset;
-		double len = _in.length();
-		return std::min(pos / len, 1.0);
-	}
-
-	bool StringDataSource::next() {
-		_offset++;
-		if (_offset >= _in.size()) {
-			return false;
+	csv::block StringDataSource::read_block() {
+		if (_read) {
+			return csv::block();
 		}
 
-		_prev = _current;
-		_current = _in[_offset];
-		return true;
+		// The entire string is a single block
+		_read = true;
+		return csv::block(_in.data() + _offset, _in.size() - _offset, true);
 	}
 
-	void StringDataSource::back() {
-		_current = _prev;
-		_prev = 0;
-		_offset--;
+	double StringDataSource::progress_at(size_t position) const {
+		double pos = position + _offset;
+		double len = _in.length();
+		return std::min(pos / len, 1.0);
 	}
 };
 };
@@ -25,8 +25,10 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
 
 #include <csv/datasource/IDataSource.hpp>
+#include <csv/datasource/utf8/Validation.hpp>
 
 namespace csv {
 namespace utf8 {
@@ -38,10 +40,68 @@ public:
 	char separator = ',';
 	char comment = '\0';
 
-protected:
+	/// How invalid UTF-8 is handled.  By default the data isn't validated
+	validation::Policy validate = validation::Unchecked;
+
+	/// The location of the first invalid UTF-8 sequence (when validating)
+	validation::location invalid;
+
+	/// Has parsing stopped at an invalid UTF-8 sequence (see validation::Fail)?
+	inline bool failed() const { return _failed; }
+
+public:
+
+	// Block access.  UTF-8 data sources supply their data as contiguous blocks of bytes, allowing the parser
+	// to scan whole runs of text at once rather than a character at a time.
+
+	/// Returns the next block of data from the source.  The block remains valid until the next call to read_block().
+	/// The end of the data is indicated by a block with eof set (which may or may not contain data)
+	virtual csv::block read_block() = 0;
+
+	/// Progress through parsing (0.0 -> 1.0) having consumed 'position' bytes of the blocks returned by read_block()
+	virtual double progress_at(size_t position) const = 0;
+
+	/// Returns the next block of data to parse, validated according to 'validate'.
+	///
+	/// A block is ended at the first invalid sequence, so that the sequence starts the following block.  The row and
+	/// column passed in are the position of the parser having consumed the previous block, which locates the sequence.
+	/// When the policy is validation::Fail, the data ends at the sequence and failed() is set.
+	csv::block next_block(size_t row, size_t column);
+
+public:
+
+	// Character access.  Implemented on top of the block access
+
+	inline virtual bool next() {
+		if (_replay) {
+			// Returning the character we stepped back from
+			_replay = false;
+			_prev = _current;
+			_current = _replayed;
+			return true;
+		}
+
+		if (_cursor == _end && !fill()) {
+			return false;
+		}
+
+		_prev = _current;
+		_current = *_cursor++;
+		return true;
+	}
+	inline virtual void back() {
+		_replay = true;
+		_replayed = _current;
+		_current = _prev;
+		_prev = 0;
+	}
+	inline virtual double progress() {
+		return progress_at(_consumed + (_cursor - _begin));
+	}
+
+	// Character detection.  These are public (as they are in IDataSource) so that the parser can
+	// bind to them statically when it is handed a concrete UTF-8 data source.
 
-	// Character detection
-	
 	inline virtual bool is_separator() const {
 		return _current == separator;
 	}
@@ -54,6 +114,20 @@ protected:
 	inline virtual bool is_quote() const {
 		return _current == '\"';
 	}
+	inline virtual bool is_eol() {
+		if (_current == '\r') {
+			if (next() == false) {
+				// Hit the end of file.  Return true and let the caller handle it
+				return true;
+			}
+
+			if (_current != '\n') {
+				back();
+			}
+			return true;
+		}
+		return _current == '\n';
+	}
 
 	// Field related
 
@@ -67,21 +141,62 @@ protected:
 		_field += _current;
 	}
 
-	virtual bool is_eol();
-
 protected:
+	/// Reset the character access and validation state (eg. when the underlying data changes)
+	void reset();
+
 	char _prev = 0;
-	char _current;
+	char _current = 0;
 
 private:
+	/// Move to the next non-empty block.  Returns false at the end of the data
+	bool fill();
+
 	std::string _field;
+
+	// The current block
+	const char* _begin = NULL;
+	const char* _cursor = NULL;
+	const char* _end = NULL;
+	bool _eof = false;
+
+	// The number of bytes in the blocks prior to the current block
+	size_t _consumed = 0;
+
+	// Character stepped back over by back()
+	bool _replay = false;
+	char _replayed = 0;
+
+	/// Validate a block, replacing any invalid sequences
+	csv::block replace_invalid(const csv::block& block, size_t offset);
+
+	// Validation state.  The offset (within the data) of the next block returned by read_block()
+	size_t _offset = 0;
+	// An incomplete sequence at the end of the previous block, which the next block should complete
+	std::string _tail;
+	// The remainder of a block that was ended at the first invalid sequence
+	csv::block _rest;
+	bool _hasRest = false;
+	// The remainder of a large block that hasn't been validated yet
+	csv::block _unchecked;
+	bool _hasUnchecked = false;
+	// Did the previous block end at the first invalid sequence?
+	bool _locating = false;
+	bool _failed = false;
+	// The sequence completing the incomplete sequence held from the previous block (or its replacement), and a
+	// block copied to replace its invalid sequences (validation::Replace)
+	std::string _head;
+	std::string _repaired;
 };
 
-class FileDataSource: public utf8::DataSource {
+class FileDataSource final: public utf8::DataSource {
 public:
 	FileDataSource() noexcept {}
 	~FileDataSource();
 
+	FileDataSource(const FileDataSource&) = delete;
+	FileDataSource& operator=(const FileDataSource&) = delete;
+
 	/// Throws csv::file_exception if unable to open file
 	FileDataSource(const char* file) {
 		if (!open(file)) {
@@ -91,19 +206,95 @@ public:
 	bool open(const char* file);
 	void close();
 
+	/// The path of the open file
+	inline const std::string& path() const { return _path; }
+	/// Is the length of the file known?  False for pipes and other streams, in which case progress is 0 until the
+	/// end of the data has been read, and 1 after it
+	inline bool has_length() const { return _hasLength; }
+	/// The size of the open file in bytes
+	inline size_t length() const { return static_cast<size_t>(_length); }
+	/// The number of bytes read from the file so far (including any byte order mark)
+	inline size_t bytes_read() const { return _bytesRead; }
+	/// The offset of the first byte of CSV data in the file (ie. following any byte order mark)
+	inline size_t data_offset() const { return _bomSize; }
+
+	/// Read (up to) the first 'size' bytes of the file, including any byte order mark, without consuming them.
+	/// They are returned again by read_block(), so a stream that can't be read twice can be sampled (eg. to detect
+	/// its encoding) and then parsed.  Returns an empty block once a block has been read.  At most a block (64KB)
+	/// can be read ahead
+	csv::block peek(size_t size);
+
+public:
+	virtual csv::block read_block();
+	virtual double progress_at(size_t position) const;
+
+private:
+	/// Read into the buffer from 'count' bytes until it holds at least 'minimum' bytes or the end of the file is
+	/// reached.  Returns the number of bytes in the buffer
+	size_t fill(size_t count, size_t minimum);
+
+	int _fd = -1;
+	bool _eof = false;
+	size_t _bytesRead = 0;
+	std::streamsize _length = 0;
+	bool _hasLength = false;
+	std::string _path;
+
+	// Size of the byte order mark at the start of the file (if any)
+	size_t _bomSize = 0;
+	// Check for a byte order mark in the first block read (when it couldn't be checked on open)
+	bool _checkBOM = false;
+	// Is the next block the first, starting at the beginning of the file?
+	bool _first = true;
+	// The number of bytes at the start of the buffer read by peek()
+	size_t _peeked = 0;
+
+	// Read buffer for the file
+	std::vector<char> _buffer;
+};
+
+/// A file data source that maps the file into memory, presenting the entire file as a single block
+class MappedFileDataSource final: public utf8::DataSource {
+public:
+	MappedFileDataSource() noexcept {}
+	~MappedFileDataSource();
+
+	MappedFileDataSource(const MappedFileDataSource&) = delete;
+	MappedFileDataSource& operator=(const MappedFileDataSource&) = delete;
+
+	/// Throws csv::file_exception if unable to open file
+	MappedFileDataSource(const char* file) {
+		if (!open(file)) {
+			throw csv::file_exception();
+		}
+	}
+	bool open(const char* file);
+	void close();
+
+	/// The size of the open file in bytes
+	inline size_t length() const { return _length; }
+	/// The contents of the open file (including any byte order mark)
+	inline const char* data() const { return _data; }
+
 public:
-	virtual bool next();
-	virtual void back();
-	virtual double progress();
+	virtual csv::block read_block();
+	virtual double progress_at(size_t position) const;
 
 private:
-	std::ifstream _in;
-	std::streamsize _length;
+	// The mapped file
+	const char* _data = NULL;
+	size_t _length = 0;
+
+	// Size of the byte order mark at the start of the file (if any)
+	size_t _bomSize = 0;
+
+	// Has the file been returned by read_block()?
+	bool _read = false;
 };
 
-class StringDataSource: public utf8::DataSource {
+class StringDataSource final: public utf8::DataSource {
 public:
-	StringDataSource() noexcept : _offset(-1) {}
+	StringDataSource() noexcept {}
 	StringDataSource(const std::string& data) {
 		if (!set(data)) {
 			throw csv::data_exception();
@@ -112,12 +303,14 @@ public:
 	bool set(const std::string& data);
 
 public:
-	virtual bool next();
-	virtual void back();
-	virtual double progress();
+	virtual csv::block read_block();
+	virtual double progress_at(size_t position) const;
 
 private:
-	size_t _offset;
+	// Offset of the first byte after the BOM (if any)
+	size_t _offset = 0;
+	// Has the string been returned by read_block()?
+	bool _read = false;
 	std::string _in;
 };
 
@@ -0,0 +1,376 @@
+//
+//  Validation.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+// Validation of UTF-8 data.  Runs of ASCII are skipped a block at a time using the same instruction sets as the
+// structural index (see structural.hpp).  With AVX2 or NEON, blocks containing multi-byte sequences are validated
+// a block at a time too (using the lookup table algorithm of Keiser and Lemire), so only a block containing an
+// error is checked a byte at a time.
+
+#include <string>
+
+#include <csv/structural.hpp>
+
+namespace csv {
+namespace utf8 {
+namespace validation {
+
+	/// How a data source handles invalid UTF-8
+	typedef enum Policy {
+		/// The data isn't validated
+		Unchecked = 0,
+		/// The first invalid sequence is reported, but the data is parsed unchanged
+		PassThrough = 1,
+		/// Each invalid sequence is replaced with U+FFFD (the first one is reported)
+		Replace = 2,
+		/// Parsing stops at the first invalid sequence, returning csv::Error
+		Fail = 3
+	} Policy;
+
+	/// The location of an invalid sequence
+	struct location {
+		/// Has an invalid sequence been found?
+		bool found = false;
+		/// The offset of the sequence within the data supplied by the data source (ie. following any byte order mark)
+		size_t offset = 0;
+		/// The row and column of the field containing the sequence
+		size_t row = 0;
+		size_t column = 0;
+	};
+
+	/// Returns the number of ASCII bytes at the start of the data
+	inline size_t ascii_length(const char* data, size_t size) {
+		size_t index = 0;
+#if defined(CSV_STRUCTURAL_AVX2)
+		for (; index + 32 <= size; index += 32) {
+			const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + index));
+			const uint32_t high = static_cast<uint32_t>(_mm256_movemask_epi8(chunk));
+			if (high != 0) {
+				return index + static_cast<size_t>(__builtin_ctz(high));
+			}
+		}
+#elif defined(CSV_STRUCTURAL_SSE2)
+		for (; index + 16 <= size; index += 16) {
+			const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + index));
+			const uint32_t high = static_cast<uint32_t>(_mm_movemask_epi8(chunk));
+			if (high != 0) {
+				return index + static_cast<size_t>(__builtin_ctz(high));
+			}
+		}
+#elif defined(CSV_STRUCTURAL_NEON)
+		for (; index + 16 <= size; index += 16) {
+			const uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(data + index));
+			if (vmaxvq_u8(chunk) >= 0x80) {
+				break;
+			}
+		}
+#endif
+		for (; index < size; index++) {
+			if (static_cast<unsigned char>(data[index]) >= 0x80) {
+				break;
+			}
+		}
+		return index;
+	}
+
+	/// Is the data entirely ASCII?
+	inline bool is_ascii(const char* data, size_t size) {
+		return ascii_length(data, size) == size;
+	}
+
+	/// The result of checking a multi-byte sequence
+	struct sequence {
+		/// The length of the sequence if it is valid.  Otherwise the number of bytes forming the invalid sequence
+		/// (the maximal subpart, which is replaced by a single U+FFFD)
+		size_t length = 0;
+		bool valid = false;
+		/// Was the sequence valid until it was cut short by the end of the data?
+		bool truncated = false;
+	};
+
+	/// Check the sequence starting with the (non-ASCII) byte at the start of the data
+	inline sequence check_sequence(const char* data, size_t size) {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+		sequence result;
+
+		// The number of bytes in the sequence, along with the range of the second byte (which rules out
+		// overlong encodings, surrogates and code points that are too large)
+		const unsigned char lead = bytes[0];
+		size_t length = 0;
+		unsigned char low = 0x80;
+		unsigned char high = 0xBF;
+		if (lead >= 0xC2 && lead <= 0xDF) {
+			length = 2;
+		}
+		else if (lead >= 0xE0 && lead <= 0xEF) {
+			length = 3;
+			if (lead == 0xE0) {
+				low = 0xA0;
+			}
+			else if (lead == 0xED) {
+				high = 0x9F;
+			}
+		}
+		else if (lead >= 0xF0 && lead <= 0xF4) {
+			length = 4;
+			if (lead == 0xF0) {
+				low = 0x90;
+			}
+			else if (lead == 0xF4) {
+				high = 0x8F;
+			}
+		}
+		else {
+			result.length = 1;
+			return result;
+		}
+
+		for (size_t index = 1; index < length; index++) {
+			if (index == size) {
+				result.length = index;
+				result.truncated = true;
+				return result;
+			}
+			if (bytes[index] < low || bytes[index] > high) {
+				result.length = index;
+				return result;
+			}
+			low = 0x80;
+			high = 0xBF;
+		}
+		result.length = length;
+		result.valid = true;
+		return result;
+	}
+
+#if defined(CSV_STRUCTURAL_AVX2) || defined(CSV_STRUCTURAL_NEON)
+
+	// Error flags for a pair of bytes, looked up by the high and low nibbles of the first byte and the high nibble
+	// of the second.  A pair is invalid if all three lookups share a flag.
+	static const uint8_t TOO_SHORT = 1 << 0;		// A lead byte followed by a lead byte or ASCII
+	static const uint8_t TOO_LONG = 1 << 1;			// ASCII followed by a continuation byte
+	static const uint8_t OVERLONG_3 = 1 << 2;		// 11100000 100_____
+	static const uint8_t TOO_LARGE = 1 << 3;		// 11110100 1001____ and above
+	static const uint8_t SURROGATE = 1 << 4;		// 11101101 101_____
+	static const uint8_t OVERLONG_2 = 1 << 5;		// 1100000_ 10______
+	static const uint8_t TOO_LARGE_1000 = 1 << 6;	// 11110101 1000____ and above
+	static const uint8_t OVERLONG_4 = 1 << 6;		// 11110000 1000____
+	static const uint8_t TWO_CONTS = 1 << 7;		// Two continuation bytes, not following a 3 or 4 byte lead
+	static const uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+	#define CSV_UTF8_BYTE_1_HIGH \
+		TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+		TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+		TOO_SHORT | OVERLONG_2, \
+		TOO_SHORT, \
+		TOO_SHORT | OVERLONG_3 | SURROGATE, \
+		TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+
+	#define CSV_UTF8_BYTE_1_LOW \
+		CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, \
+		CARRY | OVERLONG_2, \
+		CARRY, \
+		CARRY, \
+		CARRY | TOO_LARGE, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000, \
+		CARRY | TOO_LARGE | TOO_LARGE_1000
+
+	#define CSV_UTF8_BYTE_2_HIGH \
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, \
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+		TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+		TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+#endif
+
+	/// Returns the number of bytes at the start of the data that have been validated a block at a time.  This
+	/// stops at the start of a character, before the block containing the first error (if any)
+	inline size_t block_valid_length(const char* data, size_t size) {
+		size_t index = 0;
+#if defined(CSV_STRUCTURAL_AVX2)
+		const __m256i byte1High = _mm256_broadcastsi128_si256(_mm_setr_epi8(CSV_UTF8_BYTE_1_HIGH));
+		const __m256i byte1Low = _mm256_broadcastsi128_si256(_mm_setr_epi8(CSV_UTF8_BYTE_1_LOW));
+		const __m256i byte2High = _mm256_broadcastsi128_si256(_mm_setr_epi8(CSV_UTF8_BYTE_2_HIGH));
+		const __m256i nibble = _mm256_set1_epi8(0x0F);
+		// Bytes at the end of a block that start a sequence continuing into the next block
+		const __m256i incompleteLimit = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+														  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+														  static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+
+		__m256i previous = _mm256_setzero_si256();
+		__m256i incomplete = _mm256_setzero_si256();
+		for (; index + 32 <= size; index += 32) {
+			const __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + index));
+			__m256i error;
+			if (_mm256_movemask_epi8(input) == 0) {
+				// All ASCII, so the previous block mustn't have ended part way through a sequence
+				error = incomplete;
+				incomplete = _mm256_setzero_si256();
+			}
+			else {
+				// The bytes 1, 2 and 3 before each byte
+				const __m256i shifted = _mm256_permute2x128_si256(previous, input, 0x21);
+				const __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+				const __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+				const __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+
+				const __m256i special = _mm256_and_si256(
+					_mm256_and_si256(_mm256_shuffle_epi8(byte1High, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+									 _mm256_shuffle_epi8(byte1Low, _mm256_and_si256(prev1, nibble))),
+					_mm256_shuffle_epi8(byte2High, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+				// The third and fourth bytes of 3 and 4 byte sequences must be continuation bytes
+				const __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(static_cast<char>(0xE0 - 0x80)));
+				const __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(static_cast<char>(0xF0 - 0x80)));
+				const __m256i continuation = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(static_cast<char>(0x80)));
+
+				error = _mm256_xor_si256(continuation, special);
+				incomplete = _mm256_subs_epu8(input, incompleteLimit);
+			}
+			if (!_mm256_testz_si256(error, error)) {
+				break;
+			}
+			previous = input;
+		}
+#elif defined(CSV_STRUCTURAL_NEON)
+		static const uint8_t byte1HighTable[16] = { CSV_UTF8_BYTE_1_HIGH };
+		static const uint8_t byte1LowTable[16] = { CSV_UTF8_BYTE_1_LOW };
+		static const uint8_t byte2HighTable[16] = { CSV_UTF8_BYTE_2_HIGH };
+		static const uint8_t incompleteTable[16] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+													 0xF0 - 1, 0xE0 - 1, 0xC0 - 1 };
+		const uint8x16_t byte1High = vld1q_u8(byte1HighTable);
+		const uint8x16_t byte1Low = vld1q_u8(byte1LowTable);
+		const uint8x16_t byte2High = vld1q_u8(byte2HighTable);
+		const uint8x16_t incompleteLimit = vld1q_u8(incompleteTable);
+
+		uint8x16_t previous = vdupq_n_u8(0);
+		uint8x16_t incomplete = vdupq_n_u8(0);
+		for (; index + 16 <= size; index += 16) {
+			const uint8x16_t input = vld1q_u8(reinterpret_cast<const uint8_t*>(data + index));
+			uint8x16_t error;
+			if (vmaxvq_u8(input) < 0x80) {
+				// All ASCII, so the previous block mustn't have ended part way through a sequence
+				error = incomplete;
+				incomplete = vdupq_n_u8(0);
+			}
+			else {
+				// The bytes 1, 2 and 3 before each byte
+				const uint8x16_t prev1 = vextq_u8(previous, input, 15);
+				const uint8x16_t prev2 = vextq_u8(previous, input, 14);
+				const uint8x16_t prev3 = vextq_u8(previous, input, 13);
+
+				const uint8x16_t special = vandq_u8(vandq_u8(vqtbl1q_u8(byte1High, vshrq_n_u8(prev1, 4)),
+															 vqtbl1q_u8(byte1Low, vandq_u8(prev1, vdupq_n_u8(0x0F)))),
+													vqtbl1q_u8(byte2High, vshrq_n_u8(input, 4)));
+
+				// The third and fourth bytes of 3 and 4 byte sequences must be continuation bytes
+				const uint8x16_t third = vqsubq_u8(prev2, vdupq_n_u8(0xE0 - 0x80));
+				const uint8x16_t fourth = vqsubq_u8(prev3, vdupq_n_u8(0xF0 - 0x80));
+				const uint8x16_t continuation = vandq_u8(vorrq_u8(third, fourth), vdupq_n_u8(0x80));
+
+				error = veorq_u8(continuation, special);
+				incomplete = vqsubq_u8(input, incompleteLimit);
+			}
+			if (vmaxvq_u8(error) != 0) {
+				break;
+			}
+			previous = input;
+		}
+#else
+		// Without vector instructions nothing is validated a block at a time
+		(void)size;
+#endif
+
+		// Step back to the start of a sequence that continues past 'index' (the data before it is valid)
+		for (size_t back = 1; back <= 3 && back <= index; back++) {
+			const unsigned char ch = static_cast<unsigned char>(data[index - back]);
+			if (ch < 0x80) {
+				break;
+			}
+			if (ch >= 0xC0) {
+				return index - back;
+			}
+		}
+		return index;
+	}
+
+	/// Returns the number of bytes at the start of the data that are valid UTF-8.
+	///
+	/// Overlong encodings, surrogates and code points beyond U+10FFFF are invalid, as is a sequence that is
+	/// cut short by the end of the data.
+	inline size_t valid_length(const char* data, size_t size) {
+		size_t index = block_valid_length(data, size);
+		while (index < size) {
+			if (static_cast<unsigned char>(data[index]) < 0x80) {
+				index += ascii_length(data + index, size - index);
+				continue;
+			}
+			const sequence checked = check_sequence(data + index, size - index);
+			if (!checked.valid) {
+				return index;
+			}
+			index += checked.length;
+		}
+		return size;
+	}
+
+	/// Is the data entirely valid UTF-8?
+	inline bool is_valid(const char* data, size_t size) {
+		return valid_length(data, size) == size;
+	}
+
+	/// Append the data to 'out', replacing each invalid sequence with U+FFFD.  Returns the number of bytes of the data
+	/// used, which is less than 'size' if the data ends part way through a sequence that the data following it may
+	/// complete.  If this is the 'last' of the data, the incomplete sequence is replaced too
+	inline size_t replace(const char* data, size_t size, bool last, std::string& out) {
+		size_t index = 0;
+		while (index < size) {
+			const size_t valid = valid_length(data + index, size - index);
+			out.append(data + index, valid);
+			index += valid;
+			if (index == size) {
+				break;
+			}
+
+			const sequence checked = check_sequence(data + index, size - index);
+			if (checked.truncated && !last) {
+				break;
+			}
+			out.append("\xEF\xBF\xBD", 3);
+			index += checked.length;
+		}
+		return index;
+	}
+};
+};
+};
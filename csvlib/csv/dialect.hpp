@@ -0,0 +1,162 @@
+//
+//  dialect.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#pragma once
+
+#include <csv/parser.hpp>
+#include <csv/scanner.hpp>
+#include <csv/datasource/utf8/DataSource.hpp>
+
+namespace csv {
+
+/// A CSV/TSV dialect whose settings are fixed at compile time.
+///
+/// Parsing with a fixed dialect (using csv::parse<Dialect>()) specializes the scanner for the dialect, so the
+/// character comparisons (including the vectorized classification of each block) are against constants.
+/// The settings of the data source (separator, comment, trimLeadingWhitespace and skipBlankLines) are ignored.
+///
+/// Sep: The field separator
+/// Quote: The quote character
+/// Comment: The comment character, or '\0' for no comments
+/// TrimWS: Remove leading whitespace from fields
+/// SkipBlank: Ignore (step over) blank lines
+template <char Sep, char Quote = '\"', char Comment = '\0', bool TrimWS = true, bool SkipBlank = true>
+struct dialect {
+	static_assert(Sep != Quote, "The separator and quote characters must be different");
+	static_assert(Sep != '\r' && Sep != '\n' && Quote != '\r' && Quote != '\n',
+				  "Line ending characters can't be used as separators or quotes");
+	static_assert(Comment != Sep && Comment != Quote, "The comment character must differ from the separator and quote");
+
+	static constexpr char separator() { return Sep; }
+	static constexpr char quote() { return Quote; }
+	static constexpr char comment() { return Comment; }
+	static constexpr bool trimLeadingWhitespace() { return TrimWS; }
+	static constexpr bool skipBlankLines() { return SkipBlank; }
+};
+
+/// Comma separated fields with the default settings
+typedef dialect<','> comma_separated;
+
+/// Tab separated fields with the default settings
+typedef dialect<'\t'> tab_separated;
+
+/// Parse a UTF-8 data source using the given scanner, returning each field and/or record (see csv::parse())
+template <typename Dialect>
+csv::State scan(csv::basic_scanner<Dialect>& scanner,
+				utf8::DataSource& source,
+				csv::FieldCallback emitField,
+				csv::RecordCallback emitRecord) {
+	typedef csv::basic_scanner<Dialect> scanner_type;
+
+	source.cancelled = false;
+	scanner.reportFields = (emitField != nullptr);
+	scanner.columns = source.columns;
+	scanner.filter = source.filter;
+
+	while (true) {
+		switch (scanner.next()) {
+			case scanner_type::NeedData: {
+				const csv::block block = source.next_block(scanner.row(), scanner.column());
+				if (source.failed()) {
+					return State::Error;
+				}
+				scanner.feed(block.data, block.size);
+				if (block.eof) {
+					scanner.finish();
+				}
+				break;
+			}
+			case scanner_type::Field:
+				if (emitField(scanner.field()) == false) {
+					// Complete the current record and stop
+					scanner.stop();
+				}
+				break;
+			case scanner_type::Record:
+				if (emitRecord && (emitRecord(scanner.record(), source.progress_at(scanner.position())) == false)) {
+					return State::Complete;
+				}
+				break;
+			case scanner_type::Finished:
+				return State::Complete;
+		}
+
+		if (source.cancelled) {
+			return State::Cancelled;
+		}
+	}
+}
+
+/// Parse a UTF-8 data source using the given scanner, returning a view of each record (see csv::parse())
+template <typename Dialect>
+csv::State scan(csv::basic_scanner<Dialect>& scanner, utf8::DataSource& source, csv::RecordViewCallback emitRecord) {
+	typedef csv::basic_scanner<Dialect> scanner_type;
+
+	source.cancelled = false;
+	scanner.reportFields = false;
+	scanner.materialize = false;
+	scanner.columns = source.columns;
+	scanner.filter = source.filter;
+
+	while (!source.cancelled) {
+		switch (scanner.next()) {
+			case scanner_type::NeedData: {
+				const csv::block block = source.next_block(scanner.row(), scanner.column());
+				if (source.failed()) {
+					return State::Error;
+				}
+				scanner.feed(block.data, block.size);
+				if (block.eof) {
+					scanner.finish();
+				}
+				break;
+			}
+			case scanner_type::Field:
+				break;
+			case scanner_type::Record:
+				if (emitRecord && (emitRecord(scanner.record_view(), source.progress_at(scanner.position())) == false)) {
+					return State::Complete;
+				}
+				break;
+			case scanner_type::Finished:
+				return State::Complete;
+		}
+	}
+	return State::Cancelled;
+}
+
+/// Parse a UTF-8 data source using a fixed dialect.  For example,
+///
+///    csv::parse<csv::tab_separated>(source, nullptr, emitRecord);
+template <typename Dialect>
+inline csv::State parse(utf8::DataSource& source, csv::FieldCallback emitField, csv::RecordCallback emitRecord) {
+	csv::basic_scanner<Dialect> scanner;
+	return csv::scan(scanner, source, emitField, emitRecord);
+}
+
+/// Parse a UTF-8 data source using a fixed dialect, returning a view of each record
+template <typename Dialect>
+inline csv::State parse(utf8::DataSource& source, csv::RecordViewCallback emitRecord) {
+	csv::basic_scanner<Dialect> scanner;
+	return csv::scan(scanner, source, emitRecord);
+}
+};
@@ -0,0 +1,210 @@
+//
+//  filter.cpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#include "filter.hpp"
+
+#include <stdint.h>
+#include <string.h>
+#include <locale>
+#include <sstream>
+
+namespace csv {
+
+	predicate::predicate(size_t column, Test test, const std::string& value)
+		: _column(column)
+		, _test(test)
+		, _value(value) {
+		_valid = parse_number(value.data(), value.size(), _number);
+	}
+
+	/// Powers of ten that are exact as doubles
+	static const double EXACT_POWERS[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	static inline bool is_digit(char ch) {
+		return ch >= '0' && ch <= '9';
+	}
+
+	bool predicate::parse_number(const char* data, size_t size, double& number) {
+		while (size > 0 && (data[size - 1] == ' ' || data[size - 1] == '\t')) {
+			size--;
+		}
+
+		// Only decimal numbers are accepted (an optional sign, digits with an optional '.', and an optional
+		// exponent) -- not whitespace before the number, 'inf', 'nan' or hex, and the locale isn't used
+		const char* cursor = data;
+		const char* const end = data + size;
+		bool negative = false;
+		if (cursor < end && (*cursor == '+' || *cursor == '-')) {
+			negative = (*cursor == '-');
+			++cursor;
+		}
+
+		// The digits are collected as an integer while they fit, with the decimal exponent to apply to it
+		uint64_t mantissa = 0;
+		int exponent = 0;
+		bool exact = true;
+		size_t digits = 0;
+		bool fraction = false;
+		for (; cursor < end; ++cursor) {
+			if (*cursor == '.' && !fraction) {
+				fraction = true;
+				continue;
+			}
+			if (!is_digit(*cursor)) {
+				break;
+			}
+			digits++;
+			if (mantissa < (UINT64_MAX - 9) / 10) {
+				mantissa = mantissa * 10 + static_cast<uint64_t>(*cursor - '0');
+				exponent -= fraction ? 1 : 0;
+			}
+			else {
+				// A digit beyond the precision of the mantissa
+				exponent += fraction ? 0 : 1;
+				exact = exact && (*cursor == '0');
+			}
+		}
+		if (digits == 0) {
+			return false;
+		}
+
+		if (cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+			++cursor;
+			bool negativeExponent = false;
+			if (cursor < end && (*cursor == '+' || *cursor == '-')) {
+				negativeExponent = (*cursor == '-');
+				++cursor;
+			}
+			if (cursor == end || !is_digit(*cursor)) {
+				return false;
+			}
+			int value = 0;
+			for (; cursor < end && is_digit(*cursor); ++cursor) {
+				if (value < 100000) {
+					value = value * 10 + (*cursor - '0');
+				}
+			}
+			exponent += negativeExponent ? -value : value;
+		}
+		if (cursor != end) {
+			return false;
+		}
+
+		if (exact && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+			// Both the mantissa and the power of ten are exact, so a single operation rounds correctly
+			const double value = static_cast<double>(mantissa);
+			number = (exponent < 0) ? value / EXACT_POWERS[-exponent] : value * EXACT_POWERS[exponent];
+		}
+		else {
+			// Longer numbers (and larger exponents) are converted by a stream in the classic locale
+			std::istringstream stream(std::string(negative ? data + 1 : data, cursor));
+			stream.imbue(std::locale::classic());
+			stream >> number;
+			if (stream.fail()) {
+				return false;
+			}
+		}
+		if (negative) {
+			number = -number;
+		}
+		return true;
+	}
+
+	bool predicate::matches(const char* data, size_t size) const {
+		const size_t length = _value.size();
+		switch (_test) {
+			case Equals:
+				return size == length && (length == 0 || memcmp(data, _value.data(), length) == 0);
+			case NotEquals:
+				return !(size == length && (length == 0 || memcmp(data, _value.data(), length) == 0));
+			case Prefix:
+				return size >= length && (length == 0 || memcmp(data, _value.data(), length) == 0);
+			case Contains: {
+				if (length == 0) {
+					return true;
+				}
+				// Look for the first character of the value, then compare the rest
+				const char* end = data + size;
+				const char* candidate = data;
+				while (static_cast<size_t>(end - candidate) >= length) {
+					candidate = static_cast<const char*>(memchr(candidate, _value[0], (end - candidate) - length + 1));
+					if (candidate == NULL) {
+						return false;
+					}
+					if (memcmp(candidate + 1, _value.data() + 1, length - 1) == 0) {
+						return true;
+					}
+					++candidate;
+				}
+				return false;
+			}
+			default:
+				break;
+		}
+
+		double number;
+		if (!parse_number(data, size, number)) {
+			return false;
+		}
+		switch (_test) {
+			case Less:
+				return number < _number;
+			case LessOrEqual:
+				return number <= _number;
+			case Greater:
+				return number > _number;
+			case GreaterOrEqual:
+				return number >= _number;
+			default:
+				return false;
+		}
+	}
+
+	bool filter::add(const predicate& test) {
+		if (!test.valid()) {
+			return false;
+		}
+		_predicates.push_back(test);
+		if (test.column() >= _tested.size()) {
+			_tested.resize(test.column() + 1, 0);
+		}
+		_tested[test.column()] = 1;
+		return true;
+	}
+
+	void filter::clear() {
+		_predicates.clear();
+		_tested.clear();
+	}
+
+	bool filter::matches(size_t column, const char* data, size_t size) const {
+		for (const auto& test: _predicates) {
+			if (test.column() == column && !test.matches(data, size)) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
@@ -0,0 +1,131 @@
+//
+//  filter.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace csv {
+
+/// A test of the content of a field in one column
+class predicate {
+public:
+	typedef enum Test {
+		/// The field is the value
+		Equals = 0,
+		/// The field isn't the value
+		NotEquals = 1,
+		/// The field starts with the value
+		Prefix = 2,
+		/// The field contains the value
+		Contains = 3,
+		/// The field is a number less than (or equal to, or greater than...) the value.  Fields that aren't
+		/// numbers fail these tests
+		Less = 4,
+		LessOrEqual = 5,
+		Greater = 6,
+		GreaterOrEqual = 7
+	} Test;
+
+	predicate(size_t column, Test test, const std::string& value);
+
+	inline size_t column() const { return _column; }
+	inline Test test() const { return _test; }
+	inline const std::string& value() const { return _value; }
+
+	/// Is the test numeric?
+	inline bool numeric() const { return _test >= Less; }
+
+	/// Does the value of a numeric test parse as a number?
+	inline bool valid() const { return !numeric() || _valid; }
+
+	/// Does the content of a field pass the test?
+	bool matches(const char* data, size_t size) const;
+
+	/// Parse the decimal number in a field (an optional sign, digits with an optional '.', and an optional exponent),
+	/// allowing trailing whitespace.  The locale isn't used.  Returns false if the field isn't a number
+	static bool parse_number(const char* data, size_t size, double& number);
+
+private:
+	size_t _column;
+	Test _test;
+	std::string _value;
+	double _number = 0.0;
+	bool _valid = false;
+};
+
+/// A set of predicates that records must pass (all of them) to be returned by the parser.
+///
+/// Each predicate is tested against the content of its field as soon as the field has been parsed, without copying
+/// it.  Once a predicate fails the rest of the record is skipped in the same way as the columns outside a projection
+/// (see csv::projection), and the record isn't returned.  The records that are returned keep their row numbers.
+/// Any fields reported to a field callback before the record failed have already been delivered.
+class filter {
+public:
+	/// Add a predicate.  Returns false (without adding it) if the value of a numeric test isn't a number
+	bool add(const predicate& test);
+	inline bool add(size_t column, predicate::Test test, const std::string& value) {
+		return add(predicate(column, test, value));
+	}
+
+	/// Is the first record a header?  If so it's always returned, whether or not it passes the predicates, so that
+	/// the names of the columns are kept
+	bool header = false;
+
+	/// Remove all of the predicates
+	void clear();
+
+	/// Are there no predicates?
+	inline bool empty() const { return _predicates.empty(); }
+
+	/// Are the fields of the record in the row tested?  Only a header isn't
+	inline bool applies(size_t row) const {
+		return !header || row != 0;
+	}
+
+	/// Are there any predicates for the column?
+	inline bool tests(size_t column) const {
+		return column < _tested.size() && _tested[column] != 0;
+	}
+
+	/// Does a field in the column pass all of the predicates for the column?
+	bool matches(size_t column, const char* data, size_t size) const;
+
+	/// Does a record with only 'columns' fields pass the predicates for the columns it's missing?  Missing fields
+	/// are tested as if they were empty
+	inline bool matches_missing(size_t columns) const {
+		for (size_t column = columns; column < _tested.size(); column++) {
+			if (_tested[column] != 0 && !matches(column, "", 0)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	inline const std::vector<predicate>& predicates() const { return _predicates; }
+
+private:
+	std::vector<predicate> _predicates;
+	std::vector<char> _tested;
+};
+};
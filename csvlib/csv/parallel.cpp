@@ -0,0 +1,729 @@
+//
+//  parallel.cpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <algorithm>
+#include <condition_variable>
+#include <ctype.h>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string.h>
+#include <thread>
+
+#include "parallel.hpp"
+#include "scanner.hpp"
+
+#include <csv/datasource/utf8/DataSource.hpp>
+#include <csv/datasource/codepage/Codepage.hpp>
+#include <csv/datasource/utf16/DataSource.hpp>
+
+#ifdef ALLOW_ICU_EXTENSIONS
+#include <unicode/ucnv.h>
+#endif
+
+namespace csv {
+
+namespace {
+
+	/// A range of bytes within the file that is parsed as a unit
+	struct chunk {
+		size_t start = 0;
+		size_t end = 0;
+
+		/// Has the chunk been parsed?
+		bool parsed = false;
+		/// Did parsing finish at the start of a record?  If not, the end of the chunk was within a record
+		bool complete = false;
+		/// Has the chunk been joined to the preceding chunk?
+		bool joined = false;
+
+		/// The row number of the first record in the chunk
+		size_t row = 0;
+		/// The number of rows in the chunk (including any records that failed the filter)
+		size_t rows = 0;
+		/// The first invalid UTF-8 sequence in the chunk (when validating).  The row is relative to the chunk
+		utf8::validation::location invalid;
+		/// Did parsing stop at the invalid sequence (validation::Fail)?
+		bool failed = false;
+		std::vector<csv::record> records;
+		/// The converted records, when converting
+		csv::converted_chunk output;
+
+		/// Release the records (or output)
+		void release() {
+			std::vector<csv::record>().swap(records);
+			output = csv::converted_chunk();
+		}
+	};
+
+	/// How the line endings are encoded in the file
+	struct line_encoding {
+		/// The size of each code unit (2 for UTF-16), and the offset of the first code unit in the file
+		size_t unit = 1;
+		size_t origin = 0;
+		bool bigEndian = false;
+	};
+
+	/// Returns the offset following the first line ending at or after 'from'.  Returns 'length' if there
+	/// are no more line endings
+	size_t find_line_start(std::ifstream& in, size_t from, size_t length, const line_encoding& encoding) {
+		char buffer[4096];
+		bool cr = false;
+
+		// Start at a code unit
+		const size_t unit = encoding.unit;
+		size_t position = from;
+		if (position > encoding.origin) {
+			position = encoding.origin + ((position - encoding.origin + unit - 1) / unit) * unit;
+		}
+
+		in.clear();
+		in.seekg(static_cast<std::streamoff>(position), std::ios::beg);
+		while (position < length) {
+			in.read(buffer, std::min(sizeof(buffer), length - position));
+			const size_t count = static_cast<size_t>(in.gcount());
+			if (count < unit) {
+				break;
+			}
+			for (size_t index = 0; index + unit <= count; index += unit) {
+				unsigned ch = static_cast<unsigned char>(buffer[index]);
+				if (unit == 2) {
+					const unsigned next = static_cast<unsigned char>(buffer[index + 1]);
+					ch = encoding.bigEndian ? ((ch << 8) | next) : (ch | (next << 8));
+				}
+				if (cr) {
+					// Don't split a '\r\n' line ending
+					return position + index + ((ch == '\n') ? unit : 0);
+				}
+				if (ch == '\n') {
+					return position + index + unit;
+				}
+				cr = (ch == '\r');
+			}
+			position += count - (count % unit);
+		}
+		return length;
+	}
+
+	/// The buffers used by a thread to read and decode chunks
+	struct chunk_buffers {
+		chunk_buffers() {}
+		~chunk_buffers() {
+#ifdef ALLOW_ICU_EXTENSIONS
+			if (converter != NULL) {
+				ucnv_close(converter);
+			}
+#endif
+		}
+
+		chunk_buffers(const chunk_buffers&) = delete;
+		chunk_buffers& operator=(const chunk_buffers&) = delete;
+
+		std::vector<char> buffer;
+		std::vector<char> decoded;
+		/// A chunk with its invalid UTF-8 sequences replaced (validation::Replace)
+		std::string repaired;
+#ifdef ALLOW_ICU_EXTENSIONS
+		/// The converter for the file's codepage.  Converters can't be shared between threads
+		UConverter* converter = NULL;
+#endif
+	};
+
+	/// Lower case letters and digits only, so that names can be compared ignoring punctuation
+	std::string normalized(const char* name) {
+		std::string result;
+		for (const char* ch = name; *ch != '\0'; ch++) {
+			if (isalnum(static_cast<unsigned char>(*ch))) {
+				result += static_cast<char>(tolower(static_cast<unsigned char>(*ch)));
+			}
+		}
+		return result;
+	}
+
+#ifdef ALLOW_ICU_EXTENSIONS
+	/// Can chunks of a file in the codepage, split at its line endings, be decoded independently?  The codepage must
+	/// be stateless, encode the line endings as the bytes '\r' and '\n', and never use these bytes within another
+	/// character.  Other characters are parsed after they have been decoded, so they can differ from ASCII
+	bool is_resynchronizable(const char* codepage) {
+		UErrorCode status = U_ZERO_ERROR;
+		UConverter* converter = ucnv_open(codepage, &status);
+		if (U_FAILURE(status)) {
+			return false;
+		}
+
+		bool result = false;
+		const UConverterType type = ucnv_getType(converter);
+		if (type == UCNV_SBCS || type == UCNV_MBCS || type == UCNV_LATIN_1 || type == UCNV_US_ASCII) {
+			char converted[16];
+			int32_t length = ucnv_toAlgorithmic(UCNV_UTF8, converter, converted, sizeof(converted), "\r\n", 2, &status);
+			result = U_SUCCESS(status) && length == 2 && memcmp(converted, "\r\n", 2) == 0;
+
+			// A line ending following any lead byte must still be a line ending
+			UBool starters[256];
+			ucnv_getStarters(converter, starters, &status);
+			for (int lead = 0; result && U_SUCCESS(status) && lead < 256; lead++) {
+				if (!starters[lead]) {
+					continue;
+				}
+				for (const char ending: { '\n', '\r' }) {
+					const char sequence[2] = { static_cast<char>(lead), ending };
+					length = ucnv_toAlgorithmic(UCNV_UTF8, converter, converted, sizeof(converted), sequence, 2, &status);
+					if (U_FAILURE(status) || length == 0 || converted[length - 1] != ending) {
+						result = false;
+					}
+				}
+			}
+			result = result && U_SUCCESS(status);
+		}
+		ucnv_close(converter);
+		return result;
+	}
+#endif
+
+	class parallel_parser {
+	public:
+		parallel_parser(utf8::FileDataSource& source, const csv::RecordCallback& emitRecord, const csv::parallel_options& options)
+			: parallel_parser(source, emitRecord, nullptr, nullptr, options) {
+		}
+
+		parallel_parser(utf8::FileDataSource& source, const csv::ConvertCallback& convert, const csv::OutputCallback& emitOutput,
+						const csv::parallel_options& options)
+			: parallel_parser(source, nullptr, convert, emitOutput, options) {
+		}
+
+	private:
+		parallel_parser(utf8::FileDataSource& source, const csv::RecordCallback& emitRecord, const csv::ConvertCallback& convert,
+						const csv::OutputCallback& emitOutput, const csv::parallel_options& options)
+			: _source(source)
+			, _emitRecord(emitRecord)
+			, _convert(convert)
+			, _emitOutput(emitOutput)
+			, _ordered(options.ordered || convert)
+			, _codepage(options.codepage) {
+
+			if (options.encoding != NULL) {
+				resolve_encoding(options.encoding);
+			}
+
+			_threads = options.threads;
+			if (_threads == 0) {
+				_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+			}
+
+			// Limit the number of chunks held in memory awaiting delivery
+			_maxInFlight = _threads * 2;
+
+			_chunkSize = std::max<size_t>(options.chunkSize, 1);
+		}
+
+	public:
+		csv::State parse() {
+			std::ifstream in(_source.path().c_str(), std::ios::in | std::ios::binary);
+			if (!in.is_open() || !_supported) {
+				return csv::Error;
+			}
+			if (_utf16) {
+				// A byte order mark overrides the byte order of the encoding
+				unsigned char bom[2] = { 0, 0 };
+				in.read(reinterpret_cast<char*>(bom), 2);
+				if (in.gcount() == 2 && ((bom[0] == 0xFF && bom[1] == 0xFE) || (bom[0] == 0xFE && bom[1] == 0xFF))) {
+					_line.bigEndian = (bom[0] == 0xFE);
+					_line.origin = 2;
+				}
+			}
+			split(in);
+
+			std::vector<std::thread> workers;
+			for (size_t index = 0; index < _threads; index++) {
+				workers.push_back(std::thread(&parallel_parser::work, this));
+			}
+
+			resolve(in);
+
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_changed.wait(lock, [this] { return _stop || _inFlight == 0; });
+				_stop = true;
+				_changed.notify_all();
+			}
+			for (auto& worker: workers) {
+				worker.join();
+			}
+			return _state;
+		}
+
+	private:
+
+		/// Determine how to decode a file in the named encoding
+		void resolve_encoding(const char* encoding) {
+			const std::string name = normalized(encoding);
+			if (name == "utf8") {
+				return;
+			}
+			if (name == "utf16" || name == "utf16le" || name == "utf16be") {
+				_utf16 = true;
+				_line.unit = 2;
+				_line.bigEndian = (name != "utf16le");
+				return;
+			}
+			_codepage = codepage::find(encoding);
+			if (_codepage != NULL) {
+				return;
+			}
+#ifdef ALLOW_ICU_EXTENSIONS
+			if (is_resynchronizable(encoding)) {
+				_icuCodepage = encoding;
+				return;
+			}
+#endif
+			_supported = false;
+		}
+
+		/// Divide the file into chunks
+		void split(std::ifstream& in) {
+			const size_t length = _source.length();
+			// A UTF-8 byte order mark is only meaningful for UTF-8 -- in other encodings they are characters
+			size_t start = _line.origin;
+			if (is_utf8()) {
+				start = _source.data_offset();
+			}
+			while (start < length) {
+				chunk range;
+				range.start = start;
+				range.end = (length - start <= _chunkSize) ? length : find_line_start(in, start + _chunkSize, length, _line);
+				_chunks.push_back(range);
+				start = range.end;
+			}
+		}
+
+		/// Is the file decoded by ICU?
+		inline bool is_icu() const {
+#ifdef ALLOW_ICU_EXTENSIONS
+			return !_icuCodepage.empty();
+#else
+			return false;
+#endif
+		}
+
+		/// Is the file UTF-8 (ie. parsed without decoding it)?
+		inline bool is_utf8() const {
+			return _codepage == NULL && !_utf16 && !is_icu();
+		}
+
+		/// Decode a chunk read into the buffer to UTF-8, setting 'data' and 'size' to the decoded chunk.  As the
+		/// chunks start and end at line endings, they can be decoded independently.  Returns false if the chunk
+		/// couldn't be decoded
+		bool decode(chunk_buffers& buffers, const char*& data, size_t& size) {
+			std::vector<char>& decoded = buffers.decoded;
+			if (_codepage != NULL) {
+				decoded.resize(size * codepage::table::MAX_EXPANSION);
+				size = _codepage->decode(data, size, decoded.data());
+				data = decoded.data();
+			}
+			else if (_utf16) {
+				utf16::decoder decoder(_line.bigEndian ? utf16::BigEndian : utf16::LittleEndian);
+				decoded.resize(utf16::decoder::max_output(size));
+				size = decoder.decode(data, size, decoded.data(), true);
+				data = decoded.data();
+			}
+#ifdef ALLOW_ICU_EXTENSIONS
+			else if (is_icu()) {
+				UErrorCode status = U_ZERO_ERROR;
+				if (buffers.converter == NULL) {
+					buffers.converter = ucnv_open(_icuCodepage.c_str(), &status);
+					if (U_FAILURE(status)) {
+						buffers.converter = NULL;
+						return false;
+					}
+				}
+
+				// Each byte is at most a character in the Basic Multilingual Plane, so this is normally enough
+				decoded.resize(size * 3 + 4);
+				int32_t length = ucnv_toAlgorithmic(UCNV_UTF8, buffers.converter, decoded.data(),
+													static_cast<int32_t>(decoded.size()), data, static_cast<int32_t>(size), &status);
+				if (status == U_BUFFER_OVERFLOW_ERROR) {
+					status = U_ZERO_ERROR;
+					decoded.resize(static_cast<size_t>(length));
+					length = ucnv_toAlgorithmic(UCNV_UTF8, buffers.converter, decoded.data(),
+												static_cast<int32_t>(decoded.size()), data, static_cast<int32_t>(size), &status);
+				}
+				if (U_FAILURE(status)) {
+					return false;
+				}
+				size = static_cast<size_t>(length);
+				data = decoded.data();
+			}
+#endif
+			return true;
+		}
+
+		/// Parse a chunk.  Returns false if the chunk couldn't be read
+		bool parseChunk(std::ifstream& in, chunk_buffers& buffers, chunk& range) {
+			const size_t size = range.end - range.start;
+			std::vector<char>& buffer = buffers.buffer;
+			buffer.resize(size);
+			in.clear();
+			in.seekg(static_cast<std::streamoff>(range.start), std::ios::beg);
+			in.read(buffer.data(), static_cast<std::streamsize>(size));
+			if (static_cast<size_t>(in.gcount()) != size) {
+				return false;
+			}
+
+			const char* data = buffer.data();
+			size_t dataSize = size;
+			if (!decode(buffers, data, dataSize)) {
+				return false;
+			}
+
+			// Validate UTF-8 according to the source's policy.  The chunks start and end at line endings, so they can
+			// be validated independently.  The data before the first invalid sequence is scanned first, so that the
+			// scanner is positioned at the sequence once it needs more data
+			range.invalid = utf8::validation::location();
+			range.failed = false;
+			const char* rest = NULL;
+			size_t restSize = 0;
+			if (is_utf8() && _source.validate != utf8::validation::Unchecked) {
+				const size_t valid = utf8::validation::valid_length(data, dataSize);
+				if (valid < dataSize) {
+					range.invalid.found = true;
+					range.invalid.offset = range.start + valid - _source.data_offset();
+					if (_source.validate == utf8::validation::Replace) {
+						buffers.repaired.assign(data, valid);
+						utf8::validation::replace(data + valid, dataSize - valid, true, buffers.repaired);
+						data = buffers.repaired.data();
+						dataSize = buffers.repaired.size();
+					}
+					rest = data + valid;
+					restSize = dataSize - valid;
+					dataSize = valid;
+				}
+			}
+
+			csv::scanner scanner(csv::runtime_dialect(_source.separator, _source.comment, _source.trimLeadingWhitespace, _source.skipBlankLines));
+			scanner.reportFields = false;
+			scanner.materialize = !_convert;
+			scanner.columns = _source.columns;
+			scanner.filter = _source.filter;
+			// The rows of each chunk are counted from 0, so only the first chunk can start with the header
+			scanner.filter.header = scanner.filter.header && (range.start == _chunks.front().start);
+			scanner.feed(data, dataSize);
+
+			range.records.clear();
+			range.output.data.clear();
+			range.output.ends.clear();
+			if (_convert) {
+				// Reuse the output buffer of a chunk that has been delivered.  The output is usually about the same
+				// size as the input
+				if (range.output.data.capacity() == 0) {
+					std::unique_lock<std::mutex> lock(_mutex);
+					if (!_spareOutput.empty()) {
+						range.output.data.swap(_spareOutput.back());
+						_spareOutput.pop_back();
+					}
+				}
+				range.output.data.reserve(dataSize + dataSize / 8);
+			}
+			range.complete = (range.end == _source.length());
+			while (true) {
+				const csv::scanner::Event event = scanner.next();
+				if (event == csv::scanner::NeedData && rest != NULL) {
+					range.invalid.row = scanner.row();
+					range.invalid.column = scanner.column();
+					if (_source.validate == utf8::validation::Fail) {
+						// Only the records before the sequence are delivered, and the following chunks are discarded
+						range.failed = true;
+						range.complete = true;
+						range.rows = scanner.row();
+						return true;
+					}
+					scanner.feed(rest, restSize);
+					rest = NULL;
+				}
+				else if (event == csv::scanner::NeedData) {
+					if (!range.complete) {
+						range.complete = scanner.at_record_start();
+					}
+					scanner.finish();
+				}
+				else if (event == csv::scanner::Record) {
+					if (_convert) {
+						_convert(scanner.record_view(), range.output.data);
+						range.output.ends.push_back(range.output.data.size());
+					}
+					else {
+						range.records.push_back(scanner.record());
+					}
+				}
+				else if (event == csv::scanner::Finished) {
+					range.rows = scanner.row();
+					return true;
+				}
+			}
+		}
+
+		/// Deliver the records (or output) of a chunk.  Returns false if parsing should stop
+		bool deliver(chunk& range) {
+			if (_convert) {
+				return deliverOutput(range);
+			}
+
+			const size_t count = range.records.size();
+			const double length = static_cast<double>(_source.length());
+			for (size_t index = 0; index < count; index++) {
+				csv::record& record = range.records[index];
+				record.row += range.row;
+				for (auto& field: record.content) {
+					field.row = record.row;
+				}
+
+				const double position = range.start + (double(range.end - range.start) * (index + 1)) / count;
+				if (!_emitRecord(record, std::min(position / length, 1.0))) {
+					return false;
+				}
+				if (_source.cancelled) {
+					std::unique_lock<std::mutex> lock(_mutex);
+					_state = csv::Cancelled;
+					return false;
+				}
+			}
+			range.release();
+			return true;
+		}
+
+		/// Deliver the converted output of a chunk.  Returns false if parsing should stop
+		bool deliverOutput(chunk& range) {
+			range.output.row = range.row;
+			const double position = std::min(double(range.end) / _source.length(), 1.0);
+			if (!_emitOutput(range.output, position)) {
+				return false;
+			}
+			{
+				std::unique_lock<std::mutex> lock(_mutex);
+				_spareOutput.push_back(std::string());
+				_spareOutput.back().swap(range.output.data);
+			}
+			range.release();
+			if (_source.cancelled) {
+				std::unique_lock<std::mutex> lock(_mutex);
+				_state = csv::Cancelled;
+				return false;
+			}
+			return true;
+		}
+
+		/// Worker thread.  Parses chunks in order, and delivers chunks when records are delivered unordered
+		void work() {
+			std::ifstream in(_source.path().c_str(), std::ios::in | std::ios::binary);
+			chunk_buffers buffers;
+
+			std::unique_lock<std::mutex> lock(_mutex);
+			if (!in.is_open()) {
+				fail();
+				return;
+			}
+
+			while (true) {
+				_changed.wait(lock, [this] {
+					return _stop || !_deliveries.empty() || (_nextChunk < _chunks.size() && _inFlight < _maxInFlight);
+				});
+				if (_stop) {
+					return;
+				}
+
+				if (!_deliveries.empty()) {
+					chunk& range = _chunks[_deliveries.front()];
+					_deliveries.pop_front();
+					lock.unlock();
+					const bool delivered = deliver(range);
+					lock.lock();
+					finished(delivered);
+				}
+				else {
+					chunk& range = _chunks[_nextChunk++];
+					_inFlight++;
+					lock.unlock();
+					const bool parsed = parseChunk(in, buffers, range);
+					lock.lock();
+					range.parsed = true;
+					if (!parsed) {
+						fail();
+					}
+					_changed.notify_all();
+				}
+			}
+		}
+
+		/// Verify the chunks in order, assigning the row numbers and delivering (or queueing for delivery)
+		void resolve(std::ifstream& in) {
+			chunk_buffers buffers;
+			size_t row = 0;
+
+			for (size_t index = 0; index < _chunks.size(); index++) {
+				chunk& range = _chunks[index];
+
+				std::unique_lock<std::mutex> lock(_mutex);
+				_changed.wait(lock, [this, &range] { return _stop || range.parsed; });
+				if (_stop) {
+					return;
+				}
+				if (range.joined) {
+					continue;
+				}
+
+				size_t following = index + 1;
+				while (!range.complete) {
+					// The end of the chunk (and so the start of the next) was within a record.  Join the
+					// next chunk to this one and parse it again.
+					chunk& next = _chunks[following++];
+					_changed.wait(lock, [this, &next] { return _stop || next.parsed; });
+					if (_stop) {
+						return;
+					}
+					next.joined = true;
+					_inFlight--;
+					_changed.notify_all();
+					lock.unlock();
+
+					range.end = next.end;
+					next.release();
+					const bool parsed = parseChunk(in, buffers, range);
+
+					lock.lock();
+					if (!parsed) {
+						fail();
+						return;
+					}
+				}
+
+				range.row = row;
+				row += range.rows;
+
+				if (range.invalid.found && !_source.invalid.found) {
+					_source.invalid = range.invalid;
+					_source.invalid.row += range.row;
+				}
+				if (range.failed) {
+					// Stop parsing at the invalid sequence.  The chunks after it are discarded once they've been parsed
+					const size_t parsing = _nextChunk;
+					_nextChunk = _chunks.size();
+					for (size_t later = following; later < parsing; later++) {
+						chunk& discarded = _chunks[later];
+						_changed.wait(lock, [this, &discarded] { return _stop || discarded.parsed; });
+						if (_stop) {
+							return;
+						}
+						discarded.release();
+						_inFlight--;
+					}
+				}
+
+				if (_ordered) {
+					lock.unlock();
+					const bool delivered = deliver(range);
+					lock.lock();
+					finished(delivered);
+					if (!delivered) {
+						return;
+					}
+				}
+				else {
+					_deliveries.push_back(index);
+					_changed.notify_all();
+				}
+				if (range.failed) {
+					_state = csv::Error;
+					return;
+				}
+			}
+		}
+
+		/// A chunk has been delivered (must be called with the lock held)
+		void finished(bool delivered) {
+			_inFlight--;
+			if (!delivered) {
+				_stop = true;
+			}
+			_changed.notify_all();
+		}
+
+		/// Stop parsing due to an error (must be called with the lock held)
+		void fail() {
+			_state = csv::Error;
+			_stop = true;
+			_changed.notify_all();
+		}
+
+		utf8::FileDataSource& _source;
+		const csv::RecordCallback _emitRecord;
+		const csv::ConvertCallback _convert;
+		const csv::OutputCallback _emitOutput;
+		const bool _ordered;
+		const codepage::table* _codepage;
+		bool _utf16 = false;
+#ifdef ALLOW_ICU_EXTENSIONS
+		std::string _icuCodepage;
+#endif
+		/// Is the encoding supported?
+		bool _supported = true;
+		line_encoding _line;
+		size_t _threads = 1;
+		size_t _chunkSize = 0;
+		size_t _maxInFlight = 2;
+
+		std::vector<chunk> _chunks;
+
+		// State shared between the threads, guarded by _mutex
+		std::mutex _mutex;
+		std::condition_variable _changed;
+		size_t _nextChunk = 0;
+		size_t _inFlight = 0;
+		std::deque<size_t> _deliveries;
+		std::vector<std::string> _spareOutput;
+		bool _stop = false;
+		csv::State _state = csv::Complete;
+	};
+};
+
+csv::State parallel_parse(utf8::FileDataSource& source,
+						  csv::RecordCallback emitRecord,
+						  const csv::parallel_options& options) {
+	if (source.path().empty() || !source.has_length()) {
+		// Not open, or not a regular file (eg. a pipe) that can be split
+		return csv::Error;
+	}
+
+	parallel_parser parser(source, emitRecord, options);
+	return parser.parse();
+}
+
+csv::State parallel_convert(utf8::FileDataSource& source,
+							csv::ConvertCallback convert,
+							csv::OutputCallback emitOutput,
+							const csv::parallel_options& options) {
+	if (source.path().empty() || !source.has_length() || !convert || !emitOutput) {
+		return csv::Error;
+	}
+
+	parallel_parser parser(source, convert, emitOutput, options);
+	return parser.parse();
+}
+
+};
@@ -0,0 +1,117 @@
+//
+//  parallel.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <csv/parser.hpp>
+
+namespace csv {
+
+namespace utf8 {
+	class FileDataSource;
+};
+namespace codepage {
+	class table;
+};
+
+/// Options for parallel_parse()
+struct parallel_options {
+	/// The number of worker threads.  Zero uses one thread per hardware thread
+	size_t threads = 0;
+
+	/// The approximate number of bytes parsed by a worker at a time
+	size_t chunkSize = 8 * 1024 * 1024;
+
+	/// If true, records are delivered in file order on the calling thread.
+	///
+	/// If false, records are delivered on the worker threads as soon as their row numbers are known.  The
+	/// records within a chunk are delivered in order, however chunks may be delivered out of order and
+	/// concurrently so the callback must be thread safe.
+	bool ordered = true;
+
+	/// If set, the file is in this single byte codepage rather than UTF-8 (see codepage::find()).  Each chunk
+	/// is decoded to UTF-8 by the worker that parses it, so the file is decoded in parallel too
+	const codepage::table* codepage = NULL;
+
+	/// If set, the name of the file's encoding when it isn't UTF-8.  Each chunk is decoded to UTF-8 by the worker that
+	/// parses it.
+	///
+	/// UTF-16 ("UTF-16LE", "UTF-16BE", or "UTF-16" which is big endian unless the file starts with a byte order
+	/// mark) and the codepages supported by codepage::find() are decoded natively.  When built with ICU
+	/// (ALLOW_ICU_EXTENSIONS), other codepages are decoded by ICU, providing they are stateless and their line
+	/// endings can't be part of another character (so that a chunk starting at a line ending can be decoded on its
+	/// own).  This is true of codepages such as EUC-KR, EUC-JP, Shift-JIS, GBK, GB18030 and Big5, but not of
+	/// stateful encodings such as ISO-2022-JP.  Other encodings return csv::Error.
+	const char* encoding = NULL;
+};
+
+/// Parse a UTF-8 file (or a file in one of the encodings supported by parallel_options) using multiple threads.
+///
+/// The file is split into chunks which are parsed independently.  Each chunk is assumed to start at the
+/// first line ending following its nominal start.  This is verified when the preceding chunk has been
+/// parsed, and a chunk that started within a record (for example, inside a quoted field containing a
+/// line break) is joined to the preceding chunk and parsed again.  The records produced are identical
+/// to those produced by csv::parse(), including their row numbers.
+///
+/// Each worker reads the file independently, so the source is only used for its path and settings.  The source
+/// must be a regular file -- a pipe (or other stream) returns csv::Error.
+///
+/// A UTF-8 file is validated according to the source's 'validate' policy, a chunk at a time, and the first invalid
+/// sequence is reported in the source's 'invalid'.  With validation::Fail, the records before the sequence are
+/// delivered and csv::Error is returned.
+/// Setting 'cancelled' on the source (from the record callback) cancels the parse.
+csv::State parallel_parse(utf8::FileDataSource& source,
+						  csv::RecordCallback emitRecord,
+						  const csv::parallel_options& options = csv::parallel_options());
+
+/// The output produced for a chunk of the file by parallel_convert()
+struct converted_chunk {
+	/// The row number of the first row in the chunk.  This is the row of the first record unless it was rejected
+	/// by the source's filter
+	size_t row = 0;
+	/// The output for each of the records in the chunk
+	std::string data;
+	/// The offset of the end of each record's output within 'data'
+	std::vector<size_t> ends;
+
+	inline size_t size() const { return ends.size(); }
+};
+
+/// Append the output for a record.  The row numbers of the record (and its fields) are relative to the start of
+/// the chunk being converted
+typedef std::function<void(const csv::record_view& record, std::string& output)> ConvertCallback;
+/// Receive the output for a chunk of the file
+typedef std::function<bool(const csv::converted_chunk& chunk, double progress)> OutputCallback;
+
+/// Convert a file using multiple threads, eg. to write it in another format.
+///
+/// The file is split into chunks and parsed as for parallel_parse().  Rather than collecting the records of each
+/// chunk, the worker that parses a chunk passes each record to 'convert' (on the worker thread) to append to the
+/// chunk's output.  The output of the chunks is delivered to 'emitOutput' in file order on the calling thread,
+/// regardless of the 'ordered' option.  Returning false from emitOutput stops the conversion.
+csv::State parallel_convert(utf8::FileDataSource& source,
+							csv::ConvertCallback convert,
+							csv::OutputCallback emitOutput,
+							const csv::parallel_options& options = csv::parallel_options());
+};
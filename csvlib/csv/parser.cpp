@@ -24,6 +24,12 @@
 #include <iostream>
 
 #include "parser.hpp"
+#include "dialect.hpp"
+#include "scanner.hpp"
+#include "reader.hpp"
+
+#include <csv/datasource/utf8/DataSource.hpp>
+#include <csv/datasource/icu/DataSource.hpp>
 
 #define RETURN_IF_CANCELLED(parser) 	if (parser.cancelled) { return InternalState::Canceled; }
 
@@ -37,7 +43,20 @@ namespace {
 		Canceled = 3
 	} InternalState;
 
-	bool parseSeparator(csv::IDataSource& parser) {
+	/// Push the current character into the current field, or if the field is being skipped (see csv::projection)
+	/// note that it has content
+	template <typename Source>
+	inline void pushCharacter(Source& parser, bool skip, bool& skipped) {
+		if (skip) {
+			skipped = true;
+		}
+		else {
+			parser.push();
+		}
+	}
+
+	template <typename Source>
+	bool parseSeparator(Source& parser) {
 		if (parser.is_separator()) {
 			// If a separator, then move to the next character
 			return parser.next();
@@ -45,13 +64,15 @@ namespace {
 		return false;
 	}
 
-	void skipWhitespace(csv::IDataSource& parser) {
+	template <typename Source>
+	void skipWhitespace(Source& parser) {
 		while (parser.is_whitespace() && parser.next()) {
 			// Just continue reading.
 		}
 	}
 
-	InternalState parseEscapedString(csv::IDataSource& parser) {
+	template <typename Source>
+	InternalState parseEscapedString(Source& parser, bool skip, bool& skipped) {
 		// escaped = DQUOTE *(TEXTDATA / COMMA / CR / LF / 2DQUOTE) DQUOTE
 
 		// Quote has already been read.  Move to the next char
@@ -69,7 +90,7 @@ namespace {
 				}
 				else if (parser.is_quote()) {
 					// 2DQUOTE -- push the quote into the field.
-					parser.push();
+					pushCharacter(parser, skip, skipped);
 				}
 				else {
 					// If we've hit the end of an escaped string, we should attempt to locate either
@@ -91,7 +112,7 @@ namespace {
 				}
 			}
 			else {
-				parser.push();
+				pushCharacter(parser, skip, skipped);
 			}
 
 			if (!parser.next()) {
@@ -101,7 +122,8 @@ namespace {
 		return InternalState::EndOfField;
 	}
 
-	InternalState parseUnescapedString(csv::IDataSource& parser) {
+	template <typename Source>
+	InternalState parseUnescapedString(Source& parser, bool skip, bool& skipped) {
 		// non-escaped = *TEXTDATA
 		while (true) {
 
@@ -120,17 +142,17 @@ namespace {
 
 				if (parser.is_quote()) {
 					// Double quote. This is fine.
-					parser.push();
+					pushCharacter(parser, skip, skipped);
 				}
 				else {
 					// This is an error case.  A single quote in an unescaped
 					// string is bad.  Lets try to recover (assume single quote)
 					parser.back();
-					parser.push();
+					pushCharacter(parser, skip, skipped);
 				}
 			}
 			else {
-				parser.push();
+				pushCharacter(parser, skip, skipped);
 			}
 
 			// Move to the next character
@@ -141,7 +163,8 @@ namespace {
 		return InternalState::EndOfField;
 	}
 
-	InternalState parseField(csv::IDataSource& parser, bool isFirstFieldForRow) {
+	template <typename Source>
+	InternalState parseField(Source& parser, bool isFirstFieldForRow, bool skip, bool& skipped) {
 		//  field = (escaped / non-escaped)
 
 		parser.clear_field();
@@ -170,38 +193,57 @@ namespace {
 
 		InternalState returnState = InternalState::EndOfField;
 		if (parser.is_quote()) {
-			returnState = parseEscapedString(parser);
+			returnState = parseEscapedString(parser, skip, skipped);
 		}
 		else {
-			returnState = parseUnescapedString(parser);
+			returnState = parseUnescapedString(parser, skip, skipped);
 		}
 
 		return returnState;
 	}
 
-	InternalState parseRecord(csv::IDataSource& parser,
+	/// Parse a record.  The fields in the columns that aren't included in the source's projection are parsed but
+	/// left empty, and 'skipped' is set if any of them had content.  'rejected' is set if a field fails the source's
+	/// filter, in which case the rest of the record is skipped
+	template <typename Source>
+	InternalState parseRecord(Source& parser,
 							  csv::record& record,
-							  csv::FieldCallback emitField) {
+							  const csv::FieldCallback& emitField,
+							  bool& skipped,
+							  bool& rejected) {
 
 		//  record = field *(COMMA field)
 
-		csv::field field;
-
 		InternalState state = InternalState::EndOfField;
 		bool isNewRecord = true;
 		size_t column = 0;
 
 		while (true) {
 			RETURN_IF_CANCELLED(parser);
-			state = parseField(parser, isNewRecord);
+			// A field that is tested by the filter is built, even if it isn't included in the projection
+			const bool tested = !rejected && parser.filter.tests(column) && parser.filter.applies(record.row);
+			const bool skip = rejected || (!tested && !parser.columns.includes(column));
+			state = parseField(parser, isNewRecord, skip, skipped);
 			RETURN_IF_CANCELLED(parser);
 
-			field.content = parser.field();
+			// Build the field in place within the record
+			record.content.emplace_back();
+			csv::field& field = record.content.back();
+			if (!skip) {
+				field.content = parser.field();
+			}
 			field.column = column;
 			field.row = record.row;
 
-			record.add(field);
-			if (emitField && emitField(field) == false) {
+			if (tested) {
+				rejected = !parser.filter.matches(column, field.content.data(), field.content.size());
+				if (!parser.columns.includes(column)) {
+					skipped = skipped || !field.content.empty();
+					field.content.clear();
+				}
+			}
+
+			if (!rejected && emitField && emitField(field) == false) {
 				return InternalState::EndOfFile;
 			}
 
@@ -212,10 +254,12 @@ namespace {
 					if (!parseSeparator(parser)) {
 						// We have a separator at the last character in a file, which means an
 						// empty field right at the end.
-						field.content = "";
-						field.column = column + 1;
-						field.row = record.row;
-						record.add(field);
+						record.content.emplace_back();
+						record.content.back().column = column + 1;
+						record.content.back().row = record.row;
+						if (!rejected && parser.filter.tests(column + 1) && parser.filter.applies(record.row)) {
+							rejected = !parser.filter.matches(column + 1, "", 0);
+						}
 						return InternalState::EndOfFile;
 					}
 					break;
@@ -226,11 +270,13 @@ namespace {
 			column++;
 		}
 	}
-};
-
-namespace csv {
 
-	State parse(IDataSource& parser, FieldCallback emitField, RecordCallback emitRecord) {
+	/// The parser core.  Templated on the concrete data source type so that when it is instantiated for a
+	/// final data source class the per-character calls are bound (and inlined) at compile time.
+	template <typename Source>
+	csv::State parseSource(Source& parser,
+						   const csv::FieldCallback& emitField,
+						   const csv::RecordCallback& emitRecord) {
 		//  file = [header CRLF] record *(CRLF record) [CRLF]
 
 		InternalState state = InternalState::EndOfFile;
@@ -239,7 +285,7 @@ namespace csv {
 		// Move to the first character
 		if (!parser.next()) {
 			// File is empty.  Do nothing
-			return State::Complete;
+			return csv::State::Complete;
 		}
 
 		csv::record record;
@@ -249,29 +295,75 @@ namespace csv {
 			record.content.clear();
 			record.row = row;
 
-			state = parseRecord(parser, record, emitField);
+			bool skipped = false;
+			bool rejected = false;
+			state = parseRecord(parser, record, emitField, skipped, rejected);
+			// Fields missing from the end of a short record are tested as empty
+			rejected = rejected || (parser.filter.applies(row) && !parser.filter.matches_missing(record.size()));
 
-			if (!parser.skipBlankLines || !record.empty()) {
+			// Records that fail the filter keep their row
+			if (!parser.skipBlankLines || skipped || !record.empty()) {
 				row++;
-				if (emitRecord && (emitRecord(record, parser.progress()) == false)) {
-					return State::Complete;
+				if (!rejected && emitRecord && (emitRecord(record, parser.progress()) == false)) {
+					return csv::State::Complete;
 				}
 			}
 
 			if (!parser.next()) {
-				return State::Complete;
+				return csv::State::Complete;
 			}
 		}
 		while (state != InternalState::Canceled && state != InternalState::EndOfFile);
 
 		switch (state) {
 			case InternalState::Canceled:
-				return State::Cancelled;
+				return csv::State::Cancelled;
 			case InternalState::EndOfFile:
-				return State::Complete;
+				return csv::State::Complete;
 			default:
 				assert(false);
-				return State::Error;
+				return csv::State::Error;
 		}
 	}
 };
+
+namespace csv {
+
+	State parse(IDataSource& parser, FieldCallback emitField, RecordCallback emitRecord) {
+		utf8::DataSource* blockSource = dynamic_cast<utf8::DataSource*>(&parser);
+		if (blockSource != NULL) {
+			return parse(*blockSource, emitField, emitRecord);
+		}
+		return parseSource(parser, emitField, emitRecord);
+	}
+
+	State parse(utf8::DataSource& parser, FieldCallback emitField, RecordCallback emitRecord) {
+		csv::scanner scanner(csv::runtime_dialect(parser.separator, parser.comment, parser.trimLeadingWhitespace, parser.skipBlankLines));
+		return csv::scan(scanner, parser, emitField, emitRecord);
+	}
+
+	State parse(utf8::DataSource& parser, RecordViewCallback emitRecord) {
+		csv::view_reader reader(parser);
+		while (reader.next()) {
+			if (emitRecord && (emitRecord(reader.record(), reader.progress()) == false)) {
+				return State::Complete;
+			}
+		}
+		if (parser.failed()) {
+			return State::Error;
+		}
+		return parser.cancelled ? State::Cancelled : State::Complete;
+	}
+
+#ifdef ALLOW_ICU_EXTENSIONS
+
+	State parse(icu::FileDataSource& parser, FieldCallback emitField, RecordCallback emitRecord) {
+		return parseSource(parser, emitField, emitRecord);
+	}
+
+	State parse(icu::StringDataSource& parser, FieldCallback emitField, RecordCallback emitRecord) {
+		return parseSource(parser, emitField, emitRecord);
+	}
+
+#endif
+};
@@ -25,9 +25,21 @@
 #include <csv/datasource/IDataSource.hpp>
 
 #include <functional>
+#include <string.h>
 
 namespace csv {
 
+namespace utf8 {
+	class DataSource;
+};
+
+#ifdef ALLOW_ICU_EXTENSIONS
+namespace icu {
+	class FileDataSource;
+	class StringDataSource;
+};
+#endif
+
 typedef enum State {
 	Complete = 0,
 	Cancelled = 1,
@@ -60,10 +72,94 @@ struct record {
 	}
 };
 
+/// A field that refers to the parsed data rather than holding its own copy.  Only valid for the duration
+/// of the callback it is passed to -- use str() to take a copy of the content.
+struct field_view {
+	size_t row = 0;
+	size_t column = 0;
+	const char* data = NULL;
+	size_t size = 0;
+
+	/// Was the field enclosed in quotes?
+	bool quoted = false;
+	/// Does the content differ from the text between the quotes (if any), ie. did it contain doubled or stray
+	/// quotes, or text following the closing quote?
+	bool escaped = false;
+
+	/// The text of the field as it appears in the data (including any quotes, excluding any leading whitespace).
+	/// Only available (non-NULL) if the field isn't escaped and doesn't span the blocks of data being parsed
+	const char* raw = NULL;
+	size_t rawSize = 0;
+
+	inline bool empty() const { return size == 0; }
+	inline std::string str() const { return std::string(data, size); }
+
+	inline bool operator==(const std::string& other) const {
+		return size == other.size() && (size == 0 || memcmp(data, other.data(), size) == 0);
+	}
+	inline bool operator!=(const std::string& other) const { return !(*this == other); }
+};
+
+/// A record of field views.  Only valid for the duration of the callback it is passed to
+struct record_view {
+	size_t row = 0;
+	std::vector<field_view> content;
+
+	inline size_t size() const { return content.size(); }
+	inline const field_view& operator[](const size_t offset) const { return content[offset]; }
+
+	inline bool empty() const {
+		for (const auto& field: content) {
+			if (field.size > 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// Returns a copy of the record that owns its content
+	inline csv::record record() const {
+		csv::record result;
+		result.row = row;
+		result.content.resize(content.size());
+		for (size_t column = 0; column < content.size(); column++) {
+			result.content[column].row = content[column].row;
+			result.content[column].column = content[column].column;
+			result.content[column].content.assign(content[column].data, content[column].size);
+		}
+		return result;
+	}
+};
+
 typedef std::function<bool(const field&)> FieldCallback;
 typedef std::function<bool(const record&, double progress)> RecordCallback;
+typedef std::function<bool(const record_view&, double progress)> RecordViewCallback;
 
+/// Parse using the abstract data source interface.  UTF-8 data sources are parsed block by block,
+/// other data sources are read a character at a time via virtual calls.
 csv::State parse(IDataSource& parser,
 				 csv::FieldCallback emitField,
 				 csv::RecordCallback emitRecord);
+
+/// Parse a UTF-8 data source, scanning the blocks of data supplied by the source
+csv::State parse(utf8::DataSource& parser,
+				 csv::FieldCallback emitField,
+				 csv::RecordCallback emitRecord);
+
+/// Parse a UTF-8 data source, returning views of each record.  The fields refer directly to the blocks of data
+/// supplied by the source where possible, and are only copied if they contain escaped quotes or span blocks.
+csv::State parse(utf8::DataSource& parser,
+				 csv::RecordViewCallback emitRecord);
+
+// Overloads for the concrete character data sources.  The parser is statically bound to the data
+// source, allowing the per-character calls in the inner parsing loops to be inlined.
+
+#ifdef ALLOW_ICU_EXTENSIONS
+csv::State parse(icu::FileDataSource& parser,
+				 csv::FieldCallback emitField,
+				 csv::RecordCallback emitRecord);
+csv::State parse(icu::StringDataSource& parser,
+				 csv::FieldCallback emitField,
+				 csv::RecordCallback emitRecord);
+#endif
 };
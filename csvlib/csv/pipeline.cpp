@@ -0,0 +1,222 @@
+//
+//  pipeline.cpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#include <algorithm>
+#include <string.h>
+
+#include "pipeline.hpp"
+
+namespace csv {
+
+namespace utf8 {
+
+	PipelinedDataSource::PipelinedDataSource(utf8::DataSource& source, const csv::pipeline_options& options)
+		: _source(source)
+		, _bufferSize(std::max<size_t>(options.bufferSize, 1))
+		, _ring(options.buffers) {
+		separator = source.separator;
+		comment = source.comment;
+		trimLeadingWhitespace = source.trimLeadingWhitespace;
+		skipBlankLines = source.skipBlankLines;
+		columns = source.columns;
+		filter = source.filter;
+		validate = source.validate;
+
+		_reader = std::thread(&PipelinedDataSource::read, this);
+	}
+
+	PipelinedDataSource::~PipelinedDataSource() {
+		close();
+	}
+
+	void PipelinedDataSource::close() {
+		_ring.close();
+		if (_reader.joinable()) {
+			_reader.join();
+		}
+		_current = NULL;
+		_eof = true;
+	}
+
+	void PipelinedDataSource::read() {
+		size_t position = 0;
+		while (true) {
+			const csv::block block = _source.read_block();
+
+			// Split the block between as many buffers as it needs
+			size_t offset = 0;
+			do {
+				buffer* slot = _ring.write_slot();
+				if (slot == NULL) {
+					// Closed
+					return;
+				}
+
+				const size_t count = std::min(block.size - offset, _bufferSize);
+				slot->data.resize(_bufferSize);
+				if (count > 0) {
+					memcpy(slot->data.data(), block.data + offset, count);
+				}
+				slot->size = count;
+				slot->start = _source.progress_at(position + offset);
+				slot->end = _source.progress_at(position + offset + count);
+				offset += count;
+				slot->eof = block.eof && (offset == block.size);
+				_ring.push();
+			} while (offset < block.size);
+
+			position += block.size;
+			if (block.eof) {
+				return;
+			}
+		}
+	}
+
+	csv::block PipelinedDataSource::read_block() {
+		if (_current != NULL) {
+			// Hand the previous buffer back to the reading thread
+			_position += _current->size;
+			_progress = _current->end;
+			_current = NULL;
+			_ring.pop();
+		}
+
+		if (_eof) {
+			return csv::block(NULL, 0, true);
+		}
+
+		_current = _ring.read_slot();
+		if (_current == NULL) {
+			_eof = true;
+			return csv::block(NULL, 0, true);
+		}
+
+		_eof = _current->eof;
+		return csv::block(_current->data.data(), _current->size, _current->eof);
+	}
+
+	double PipelinedDataSource::progress_at(size_t position) const {
+		if (_current == NULL || _current->size == 0 || position < _position) {
+			return _progress;
+		}
+
+		// Interpolate within the current buffer
+		const double fraction = std::min(static_cast<double>(position - _position) / _current->size, 1.0);
+		return _current->start + fraction * (_current->end - _current->start);
+	}
+};
+
+namespace {
+
+	/// A batch of records handed from the parsing thread to the calling thread
+	struct batch {
+		std::vector<csv::record> records;
+		std::vector<double> progress;
+		size_t count = 0;
+		/// Is this the last batch?
+		bool last = false;
+	};
+};
+
+	csv::State pipelined_parse(utf8::DataSource& source, csv::RecordCallback emitRecord, const csv::pipeline_options& options) {
+		source.cancelled = false;
+
+		utf8::PipelinedDataSource input(source, options);
+		csv::spsc_ring<batch> batches(options.buffers);
+		const size_t batchSize = std::max<size_t>(options.batchSize, 1);
+
+		csv::State parsed = State::Complete;
+		std::thread parser([&input, &batches, batchSize, &parsed]() {
+			batch* current = batches.write_slot();
+			if (current != NULL) {
+				current->count = 0;
+			}
+
+			parsed = csv::parse(input, nullptr, [&current, &batches, batchSize](const csv::record& record, double progress) -> bool {
+				if (current == NULL) {
+					return false;
+				}
+				if (current->count == current->records.size()) {
+					current->records.emplace_back();
+					current->progress.emplace_back();
+				}
+				// Assigning reuses the fields (and their storage) from earlier batches
+				current->records[current->count] = record;
+				current->progress[current->count] = progress;
+				current->count++;
+
+				if (current->count == batchSize) {
+					current->last = false;
+					batches.push();
+					current = batches.write_slot();
+					if (current == NULL) {
+						// Closed by the calling thread
+						return false;
+					}
+					current->count = 0;
+				}
+				return true;
+			});
+
+			if (current != NULL) {
+				current->last = true;
+				batches.push();
+			}
+		});
+
+		csv::State state = State::Complete;
+		bool running = true;
+		while (running) {
+			batch* current = batches.read_slot();
+			if (current == NULL) {
+				break;
+			}
+
+			for (size_t index = 0; index < current->count; index++) {
+				if (emitRecord && (emitRecord(current->records[index], current->progress[index]) == false)) {
+					running = false;
+					break;
+				}
+				if (source.cancelled) {
+					state = State::Cancelled;
+					running = false;
+					break;
+				}
+			}
+
+			running = running && !current->last;
+			batches.pop();
+		}
+
+		// Stop the parsing and reading threads (if they haven't already finished)
+		batches.close();
+		parser.join();
+		input.close();
+
+		// The data was validated as it was parsed (if at all)
+		source.invalid = input.invalid;
+		if (parsed == State::Error && state == State::Complete) {
+			state = State::Error;
+		}
+		return state;
+	}
+};
@@ -0,0 +1,203 @@
+//
+//  pipeline.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <csv/parser.hpp>
+#include <csv/datasource/utf8/DataSource.hpp>
+
+namespace csv {
+
+/// A fixed size queue between a single producer thread and a single consumer thread.
+///
+/// The producer fills the slot returned by write_slot() and publishes it using push().  The consumer reads
+/// the slot returned by read_slot() and hands it back using pop().  The slots are reused, so any buffers
+/// they hold are only allocated once.  Handing over a slot doesn't take a lock -- a thread only sleeps (and
+/// is woken) when the queue is full or empty.
+template <typename T>
+class spsc_ring {
+public:
+	spsc_ring(size_t capacity)
+		: _slots(std::max<size_t>(capacity, 1)) {
+	}
+
+	spsc_ring(const spsc_ring&) = delete;
+	spsc_ring& operator=(const spsc_ring&) = delete;
+
+	/// The next slot to fill, waiting while the queue is full.  Returns NULL if the queue has been closed
+	T* write_slot() {
+		const size_t head = _head.load(std::memory_order_relaxed);
+		if (!wait([this, head]() { return head - _tail.load() < _slots.size(); })) {
+			return NULL;
+		}
+		return &_slots[head % _slots.size()];
+	}
+
+	/// Publish the slot returned by write_slot()
+	void push() {
+		_head.store(_head.load(std::memory_order_relaxed) + 1);
+		wake();
+	}
+
+	/// The next slot to read, waiting while the queue is empty.  Returns NULL if the queue has been closed
+	T* read_slot() {
+		const size_t tail = _tail.load(std::memory_order_relaxed);
+		if (!wait([this, tail]() { return _head.load() != tail; })) {
+			return NULL;
+		}
+		return &_slots[tail % _slots.size()];
+	}
+
+	/// Hand back the slot returned by read_slot()
+	void pop() {
+		_tail.store(_tail.load(std::memory_order_relaxed) + 1);
+		wake();
+	}
+
+	/// Close the queue, waking both threads.  Any further calls to write_slot() and read_slot() return NULL
+	void close() {
+		_closed.store(true);
+		std::lock_guard<std::mutex> lock(_mutex);
+		_signal.notify_all();
+	}
+
+private:
+	template <typename Ready>
+	bool wait(Ready ready) {
+		// The other thread is usually only briefly behind, so spin for a while before sleeping
+		for (int spin = 0; spin < 64; spin++) {
+			if (_closed.load()) {
+				return false;
+			}
+			if (ready()) {
+				return true;
+			}
+			std::this_thread::yield();
+		}
+
+		std::unique_lock<std::mutex> lock(_mutex);
+		_sleeping++;
+		_signal.wait(lock, [this, &ready]() { return _closed.load() || ready(); });
+		_sleeping--;
+		return !_closed.load();
+	}
+
+	void wake() {
+		// The sleeping count is incremented before the sleeping thread checks the queue, so either that
+		// check sees the change or the count is seen here
+		if (_sleeping.load() > 0) {
+			std::lock_guard<std::mutex> lock(_mutex);
+			_signal.notify_all();
+		}
+	}
+
+	std::vector<T> _slots;
+	std::atomic<size_t> _head { 0 };
+	std::atomic<size_t> _tail { 0 };
+	std::atomic<bool> _closed { false };
+
+	std::mutex _mutex;
+	std::condition_variable _signal;
+	std::atomic<int> _sleeping { 0 };
+};
+
+/// Options for pipelined parsing
+struct pipeline_options {
+	/// The size of each buffer handed from the reading thread to the parser
+	size_t bufferSize = 256 * 1024;
+
+	/// The number of buffers (and batches of records) that can be waiting.  When these are full, the
+	/// thread producing them waits for the thread consuming them to catch up
+	size_t buffers = 8;
+
+	/// The number of records handed from the parsing thread to the record callback at a time
+	size_t batchSize = 1024;
+};
+
+namespace utf8 {
+
+	/// A data source that reads (and for transcoding sources, converts) another UTF-8 data source on a
+	/// background thread, so that reading the data overlaps with parsing it.
+	///
+	/// The blocks read from the source are copied into a ring of fixed size buffers.  The source must not be
+	/// used while it is being read by the pipeline.  The separator, comment and other settings are copied from
+	/// the source.
+	class PipelinedDataSource final: public utf8::DataSource {
+	public:
+		PipelinedDataSource(utf8::DataSource& source,
+							const csv::pipeline_options& options = csv::pipeline_options());
+		~PipelinedDataSource();
+
+		PipelinedDataSource(const PipelinedDataSource&) = delete;
+		PipelinedDataSource& operator=(const PipelinedDataSource&) = delete;
+
+		/// Stop reading the source
+		void close();
+
+	public:
+		virtual csv::block read_block();
+		virtual double progress_at(size_t position) const;
+
+	private:
+		struct buffer {
+			std::vector<char> data;
+			size_t size = 0;
+			bool eof = false;
+			/// Progress through the source at the start and end of the buffer
+			double start = 0.0;
+			double end = 0.0;
+		};
+
+		/// Read the source into the ring (on the reading thread)
+		void read();
+
+		utf8::DataSource& _source;
+		const size_t _bufferSize;
+		csv::spsc_ring<buffer> _ring;
+		std::thread _reader;
+
+		// The buffer returned by read_block()
+		buffer* _current = NULL;
+		size_t _position = 0;
+		double _progress = 0.0;
+		bool _eof = false;
+	};
+};
+
+/// Parse a UTF-8 data source using three threads.
+///
+/// One thread reads the source (see utf8::PipelinedDataSource), another parses the data, and the records are
+/// delivered to the callback on the calling thread in batches.  The records and their row numbers are
+/// identical to those produced by csv::parse().  Setting 'cancelled' on the source (from the record callback)
+/// cancels the parse.  The data is validated according to the source's 'validate' policy, and the first invalid
+/// sequence (if any) is reported in its 'invalid' location.
+csv::State pipelined_parse(utf8::DataSource& source,
+						   csv::RecordCallback emitRecord,
+						   const csv::pipeline_options& options = csv::pipeline_options());
+};
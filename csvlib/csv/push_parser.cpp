@@ -0,0 +1,190 @@
+//
+//  push_parser.cpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#include <algorithm>
+#include <string.h>
+
+#include "push_parser.hpp"
+#include "scanner.hpp"
+
+#include <csv/datasource/utf8/DataSource.hpp>
+
+namespace csv {
+
+	namespace {
+		const char BOM[3] = { '\xEF', '\xBB', '\xBF' };
+	};
+
+	class push_parser::validated_data final: public utf8::DataSource {
+	public:
+		/// Set the piece of data returned by the next read_block()
+		void set(const char* data, size_t size, bool last) {
+			_piece = csv::block(data, size, last);
+			_read = false;
+			_drained = false;
+		}
+
+		/// Has the piece been returned, and so validated?
+		inline bool drained() const { return _drained; }
+
+		virtual csv::block read_block() {
+			_drained = _read;
+			if (_read) {
+				return csv::block(NULL, 0, false);
+			}
+			_read = true;
+			return _piece;
+		}
+		virtual double progress_at(size_t) const {
+			// The push parser reports its own progress
+			return 0.0;
+		}
+
+	private:
+		csv::block _piece;
+		bool _read = true;
+		bool _drained = false;
+	};
+
+	push_parser::push_parser(csv::RecordCallback emitRecord, csv::FieldCallback emitField)
+		: _emitRecord(emitRecord)
+		, _emitField(emitField) {
+	}
+
+	push_parser::~push_parser() {
+	}
+
+	bool push_parser::feed(const char* data, size_t size) {
+		if (_stopped) {
+			return false;
+		}
+
+		if (!_checkedBOM) {
+			// The byte order mark (if any) may be split between calls, so hold the first bytes until it is known
+			const size_t count = std::min(size, sizeof(BOM) - _head.size());
+			_head.append(data, count);
+			data += count;
+			size -= count;
+
+			if (_head.size() < sizeof(BOM) && memcmp(_head.data(), BOM, _head.size()) == 0) {
+				return true;
+			}
+
+			_checkedBOM = true;
+			if (_head.compare(0, std::string::npos, BOM, sizeof(BOM)) == 0) {
+				_position = sizeof(BOM);
+			}
+			else if (!scan(_head.data(), _head.size(), false)) {
+				return false;
+			}
+		}
+
+		return scan(data, size, false);
+	}
+
+	csv::State push_parser::finish() {
+		if (!_stopped) {
+			if (!_checkedBOM) {
+				// Less data than a byte order mark
+				_checkedBOM = true;
+				scan(_head.data(), _head.size(), true);
+			}
+			else {
+				scan(NULL, 0, true);
+			}
+		}
+		_stopped = true;
+		if (_failed) {
+			return State::Error;
+		}
+		return cancelled ? State::Cancelled : State::Complete;
+	}
+
+	bool push_parser::scan(const char* data, size_t size, bool last) {
+		if (!_scanner) {
+			_scanner.reset(new csv::scanner(csv::runtime_dialect(separator, comment, trimLeadingWhitespace, skipBlankLines)));
+			_scanner->reportFields = (_emitField != nullptr);
+			_scanner->columns = columns;
+			_scanner->filter = filter;
+		}
+		if (validate == utf8::validation::Unchecked) {
+			return consume(data, size, last);
+		}
+
+		// Validate the data a block at a time, as a data source does.  A block may be split (at the first invalid
+		// sequence, or a sequence split between pieces), so the scanner consumes each block before the next is
+		// validated
+		if (!_validated) {
+			_validated.reset(new validated_data());
+			_validated->validate = validate;
+		}
+		_validated->set(data, size, last);
+		while (true) {
+			const csv::block block = _validated->next_block(_scanner->row(), _scanner->column());
+			invalid = _validated->invalid;
+			if (_validated->failed()) {
+				_failed = true;
+				_stopped = true;
+				return false;
+			}
+			if (_validated->drained()) {
+				return true;
+			}
+			if (!consume(block.data, block.size, block.eof)) {
+				return false;
+			}
+		}
+	}
+
+	bool push_parser::consume(const char* data, size_t size, bool last) {
+		_scanner->feed(data, size);
+		if (last) {
+			_scanner->finish();
+		}
+
+		while (!cancelled) {
+			switch (_scanner->next()) {
+				case scanner::NeedData:
+					// The scanner has copied any partial field, so the data isn't needed any more
+					return true;
+				case scanner::Field:
+					if (_emitField(_scanner->field()) == false) {
+						// Complete the current record and stop
+						_scanner->stop();
+					}
+					break;
+				case scanner::Record:
+					if (_emitRecord && (_emitRecord(_scanner->record(), _position + _scanner->position()) == false)) {
+						_stopped = true;
+						return false;
+					}
+					break;
+				case scanner::Finished:
+					_stopped = true;
+					return false;
+			}
+		}
+
+		_stopped = true;
+		return false;
+	}
+};
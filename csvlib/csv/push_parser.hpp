@@ -0,0 +1,107 @@
+//
+//  push_parser.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <memory>
+
+#include <csv/parser.hpp>
+#include <csv/datasource/utf8/Validation.hpp>
+
+namespace csv {
+
+class runtime_dialect;
+template <typename Dialect> class basic_scanner;
+typedef basic_scanner<runtime_dialect> scanner;
+
+/// Parses UTF-8 CSV/TSV data that is supplied a piece at a time (for example, as it arrives over a network).
+///
+/// Data is pushed into the parser using feed(), and each record is delivered to the callbacks as soon as it is
+/// complete.  The data passed to feed() isn't retained -- only the record in progress is kept between calls,
+/// regardless of how the data is split.  Call finish() once all of the data has been supplied.
+///
+/// The progress passed to the record callback is the number of bytes parsed so far.
+class push_parser {
+public:
+	push_parser(csv::RecordCallback emitRecord, csv::FieldCallback emitField = nullptr);
+	~push_parser();
+
+	push_parser(const push_parser&) = delete;
+	push_parser& operator=(const push_parser&) = delete;
+
+	// Parser settings.  These must be set before the first call to feed()
+
+	char separator = ',';
+	char comment = '\0';
+
+	/// Remove leading whitespace from fields
+	bool trimLeadingWhitespace = true;
+
+	/// Ignore (step over) blank lines rather than return a blank record for empty lines
+	bool skipBlankLines = true;
+
+	/// The columns to build (by default, all of them)
+	csv::projection columns;
+
+	/// The predicates that records must pass to be returned (by default, none)
+	csv::filter filter;
+
+	/// How invalid UTF-8 is handled (see utf8::DataSource).  By default the data isn't validated
+	utf8::validation::Policy validate = utf8::validation::Unchecked;
+
+	/// The location of the first invalid UTF-8 sequence (when validating)
+	utf8::validation::location invalid;
+
+	/// Set to true to cancel the current parsing
+	bool cancelled = false;
+
+	/// Parse the next piece of data.  Returns false if parsing has stopped (a callback returned false, parsing
+	/// was cancelled, or it stopped at an invalid UTF-8 sequence), in which case any further data is ignored
+	bool feed(const char* data, size_t size);
+
+	/// Indicate that there is no more data, delivering the final record (if any).  Returns csv::Error if parsing
+	/// stopped at an invalid UTF-8 sequence (see validation::Fail)
+	csv::State finish();
+
+private:
+	/// Validate the data (if required), and scan it until it has been consumed (or parsing stops)
+	bool scan(const char* data, size_t size, bool last);
+	/// Scan the data until it has been consumed (or parsing stops)
+	bool consume(const char* data, size_t size, bool last);
+
+	/// The pieces of data presented as a UTF-8 data source, which validates them
+	class validated_data;
+
+	csv::RecordCallback _emitRecord;
+	csv::FieldCallback _emitField;
+	std::unique_ptr<csv::scanner> _scanner;
+	std::unique_ptr<validated_data> _validated;
+
+	// The first bytes of the data, held until it is known whether or not they are a byte order mark
+	std::string _head;
+	bool _checkedBOM = false;
+
+	size_t _position = 0;
+	bool _stopped = false;
+	bool _failed = false;
+};
+
+};
@@ -0,0 +1,86 @@
+//
+//  reader.cpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#include <type_traits>
+
+#include "reader.hpp"
+
+#include <csv/datasource/utf8/DataSource.hpp>
+
+namespace csv {
+
+	template <typename Record>
+	basic_reader<Record>::basic_reader(utf8::DataSource& source)
+		: _source(source)
+		, _scanner(csv::runtime_dialect(source.separator, source.comment, source.trimLeadingWhitespace, source.skipBlankLines)) {
+		_source.cancelled = false;
+		_scanner.reportFields = false;
+		_scanner.materialize = std::is_same<Record, csv::record>::value;
+		_scanner.columns = source.columns;
+		_scanner.filter = source.filter;
+	}
+
+	template <typename Record>
+	bool basic_reader<Record>::next() {
+		_current = false;
+		while (!_finished && !_source.cancelled) {
+			switch (_scanner.next()) {
+				case scanner::NeedData: {
+					const csv::block block = _source.next_block(_scanner.row(), _scanner.column());
+					if (_source.failed()) {
+						_finished = true;
+						break;
+					}
+					_scanner.feed(block.data, block.size);
+					if (block.eof) {
+						_scanner.finish();
+					}
+					break;
+				}
+				case scanner::Field:
+					break;
+				case scanner::Record:
+					_current = true;
+					return true;
+				case scanner::Finished:
+					_finished = true;
+					break;
+			}
+		}
+		return false;
+	}
+
+	template <typename Record>
+	double basic_reader<Record>::progress() const {
+		return _source.progress_at(_scanner.position());
+	}
+
+	template <typename Record>
+	typename basic_reader<Record>::iterator basic_reader<Record>::begin() {
+		if (_current || next()) {
+			return iterator(this);
+		}
+		return end();
+	}
+
+	template class basic_reader<csv::record>;
+	template class basic_reader<csv::record_view>;
+};
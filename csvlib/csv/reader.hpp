@@ -0,0 +1,105 @@
+//
+//  reader.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+
+#include <csv/parser.hpp>
+#include <csv/scanner.hpp>
+
+namespace csv {
+
+/// Reads the records of a UTF-8 data source one at a time, as an alternative to the callbacks of csv::parse().
+///
+/// The reader holds the state of the parse, so the caller decides when to read the next record (for example,
+/// stepping through several files in step with each other).  The record returned is reused for each record,
+/// and is only valid until the next record is read.
+///
+/// Use csv::reader to read csv::record values, or csv::view_reader to read csv::record_view values (which
+/// avoid copying the fields).
+template <typename Record>
+class basic_reader {
+public:
+	basic_reader(utf8::DataSource& source);
+
+	basic_reader(const basic_reader&) = delete;
+	basic_reader& operator=(const basic_reader&) = delete;
+
+	/// Move to the next record.  Returns false when there are no more records (or the source is cancelled)
+	bool next();
+
+	/// The current record
+	inline const Record& record() const { return current(static_cast<const Record*>(NULL)); }
+
+	/// Progress through the source (see utf8::DataSource::progress_at())
+	double progress() const;
+
+	/// Input iterator over the remaining records
+	class iterator {
+	public:
+		typedef std::input_iterator_tag iterator_category;
+		typedef Record value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const Record* pointer;
+		typedef const Record& reference;
+
+		iterator(): _reader(NULL) {}
+		explicit iterator(basic_reader* reader): _reader(reader) {}
+
+		inline const Record& operator*() const { return _reader->record(); }
+		inline const Record* operator->() const { return &_reader->record(); }
+
+		inline iterator& operator++() {
+			if (!_reader->next()) {
+				_reader = NULL;
+			}
+			return *this;
+		}
+
+		inline bool operator==(const iterator& other) const { return _reader == other._reader; }
+		inline bool operator!=(const iterator& other) const { return _reader != other._reader; }
+
+	private:
+		basic_reader* _reader;
+	};
+
+	/// An iterator at the current record, reading the first record if none has been read yet
+	iterator begin();
+	inline iterator end() { return iterator(); }
+
+private:
+	inline const csv::record& current(const csv::record*) const { return _scanner.record(); }
+	inline const csv::record_view& current(const csv::record_view*) const { return _scanner.record_view(); }
+
+	utf8::DataSource& _source;
+	csv::scanner _scanner;
+	bool _current = false;
+	bool _finished = false;
+};
+
+typedef basic_reader<csv::record> reader;
+typedef basic_reader<csv::record_view> view_reader;
+
+extern template class basic_reader<csv::record>;
+extern template class basic_reader<csv::record_view>;
+};
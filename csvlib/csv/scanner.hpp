@@ -0,0 +1,703 @@
+//
+//  scanner.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+
+#include <csv/parser.hpp>
+#include <csv/structural.hpp>
+
+namespace csv {
+
+/// The characters and rules used by a scanner, configured at runtime (see csv::dialect in dialect.hpp for
+/// dialects that are fixed at compile time)
+class runtime_dialect {
+public:
+	runtime_dialect(char separator, char comment, bool trimLeadingWhitespace, bool skipBlankLines, char quote = '\"')
+		: _separator(separator)
+		, _quote(quote)
+		, _comment(comment)
+		, _trimLeadingWhitespace(trimLeadingWhitespace)
+		, _skipBlankLines(skipBlankLines) {
+	}
+
+	inline char separator() const { return _separator; }
+	inline char quote() const { return _quote; }
+	inline char comment() const { return _comment; }
+	inline bool trimLeadingWhitespace() const { return _trimLeadingWhitespace; }
+	inline bool skipBlankLines() const { return _skipBlankLines; }
+
+private:
+	char _separator;
+	char _quote;
+	char _comment;
+	bool _trimLeadingWhitespace;
+	bool _skipBlankLines;
+};
+
+/// Tokenizes UTF-8 CSV/TSV data that is supplied as contiguous blocks of bytes.
+///
+/// The scanner is a resumable state machine, so a field or record can span any number of blocks.  Within
+/// a block whole runs of unquoted or quoted text are located using a structural index of the data (see
+/// structural.hpp) and copied at once.
+///
+/// The Dialect provides the separator, quote and comment characters along with the whitespace and blank line
+/// rules.  A dialect whose settings are compile time constants (csv::dialect) lets the compiler specialize
+/// the scanner for those settings.
+template <typename Dialect>
+class basic_scanner {
+public:
+	/// Events reported by next()
+	typedef enum Event {
+		/// The current block has been consumed.  Supply the next block using feed(), or call finish()
+		NeedData = 0,
+		/// A field has been completed.  The field is available via field()
+		Field = 1,
+		/// A record has been completed.  The record is available via record()
+		Record = 2,
+		/// All of the data has been consumed
+		Finished = 3
+	} Event;
+
+	basic_scanner(const Dialect& dialect = Dialect())
+		: _dialect(dialect) {
+	}
+
+	/// Report a Field event for each completed field.
+	bool reportFields = true;
+
+	/// Copy each field into the record returned by record() (and field()).  If false, only the views returned
+	/// by record_view() (and field_view()) are available.  The views refer directly to the supplied blocks of
+	/// data wherever possible, and are available whether or not the fields are copied.
+	bool materialize = true;
+
+	/// The columns to build.  The fields in the other columns are left empty (see csv::projection).  Can be
+	/// changed between records
+	csv::projection columns;
+
+	/// The predicates that records must pass to be reported (see csv::filter).  Can be changed between records
+	csv::filter filter;
+
+	/// Supply the next block of data.  The block must remain valid until next() returns NeedData
+	void feed(const char* data, size_t size);
+
+	/// Indicate that there is no more data to come
+	void finish();
+
+	/// Scan until the next event
+	Event next();
+
+	/// Stop scanning.  The current record (if any) is completed and reported before finishing
+	void stop();
+
+	/// The most recently completed field.  Valid until the next call to next()
+	inline const csv::field& field() const { return _record.content[_column - 1]; }
+
+	/// The most recently completed record.  Valid until the next call to next()
+	inline const csv::record& record() const { return _record; }
+
+	/// Views of the most recently completed field and record.  Valid until the next call to next()
+	inline const csv::field_view& field_view() const { return _view.content[_column - 1]; }
+	inline const csv::record_view& record_view() const { return _view; }
+
+	/// The number of bytes consumed so far
+	inline size_t position() const { return _consumed + (_cursor - _begin); }
+
+	/// The row and column of the field being scanned
+	inline size_t row() const { return _row; }
+	inline size_t column() const { return _column; }
+
+	/// Is the scanner positioned at the start of a record (ie. not within a field, quoted field or comment)?
+	inline bool at_record_start() const { return _state == RecordStart && !_lineEnded; }
+
+private:
+	typedef enum ScanState {
+		RecordStart = 0,
+		FieldStart = 1,
+		Whitespace = 2,
+		Unquoted = 3,
+		UnquotedQuote = 4,
+		Quoted = 5,
+		QuotedQuote = 6,
+		AfterQuoted = 7,
+		Comment = 8,
+		Done = 9
+	} ScanState;
+
+	void startField();
+	bool endField();
+	bool endLine();
+	bool completeRecord();
+	void startFieldContent(char ch);
+
+	/// Add the text between from and to (within the current block) to the current field
+	inline void append(const char* from, const char* to) {
+		if (_skip) {
+			_skipped = _skipped || (from != to);
+			return;
+		}
+		if (_span == NULL) {
+			_span = from;
+		}
+		else if (_spanEnd != from) {
+			// Not contiguous with the text so far, so the field has to be copied
+			_pending.append(_span, _spanEnd - _span);
+			_span = from;
+		}
+		_spanEnd = to;
+	}
+
+	/// Add a character that isn't within the current block to the current field
+	inline void append(char ch) {
+		if (_skip) {
+			_skipped = true;
+			return;
+		}
+		if (_span != NULL) {
+			_pending.append(_span, _spanEnd - _span);
+			_span = NULL;
+		}
+		_pending.push_back(ch);
+	}
+
+	/// Copy any fields that refer to the current block before it is replaced
+	void detach();
+
+	/// Structural index masks
+	typedef enum IndexMask {
+		Quotes = 0,
+		Special = 1,
+		LineEndings = 2
+	} IndexMask;
+
+	/// Returns the first character at or after 'from' in the current block that is set in the given index mask
+	const char* find(const char* from, IndexMask mask);
+
+	/// Offset for fields that haven't been copied into the record's storage
+	static const size_t NOT_STORED = static_cast<size_t>(-1);
+
+	// Configuration
+	const Dialect _dialect;
+
+	// The current block
+	const char* _begin = NULL;
+	const char* _cursor = NULL;
+	const char* _end = NULL;
+	size_t _consumed = 0;
+	bool _finished = false;
+
+	// The structural index for the 64 byte window of the current block starting at _window
+	const char* _window = NULL;
+	uint64_t _windowMasks[3];
+
+	// Parsing state
+	ScanState _state = RecordStart;
+	bool _firstField = true;
+	bool _pendingCR = false;
+	bool _lineEnded = false;
+	bool _recordComplete = false;
+
+	// The record being built.  Field slots are reused between records to avoid reallocating
+	csv::record _record;
+	csv::record_view _view;
+	size_t _column = 0;
+	size_t _row = 0;
+
+	// The content of the current field is the text copied into _pending, followed by the text between
+	// _span and _spanEnd in the current block
+	const char* _span = NULL;
+	const char* _spanEnd = NULL;
+	std::string _pending;
+
+	// The start of the current field's text in the current block (NULL if it started in an earlier block), and
+	// whether the field is quoted and/or escaped
+	const char* _raw = NULL;
+	bool _quoted = false;
+	bool _escaped = false;
+
+	// Is the current field being skipped (see 'columns'), and did any of the skipped fields of the record have content?
+	bool _skip = false;
+	bool _skipped = false;
+
+	// Is the current field tested by the filter, and has the record failed the filter?
+	bool _tested = false;
+	bool _rejected = false;
+
+	// Storage for the fields of the current record that have been copied, and the offset of each field
+	// within it (or NOT_STORED if the field refers to the data)
+	std::string _storage;
+	std::vector<size_t> _offsets;
+};
+
+// The scanner follows the same rules as the character parser in parser.cpp (including its handling of
+// badly quoted fields, comments and leading whitespace) so that both produce identical records.
+
+	template <typename Dialect>
+	const size_t basic_scanner<Dialect>::NOT_STORED;
+
+	template <typename Dialect>
+	void basic_scanner<Dialect>::feed(const char* data, size_t size) {
+		assert(_cursor == _end);
+		_consumed += (_end - _begin);
+		_begin = _cursor = data;
+		_end = data + size;
+		_window = NULL;
+	}
+
+	template <typename Dialect>
+	const char* basic_scanner<Dialect>::find(const char* from, IndexMask mask) {
+		while (from < _end) {
+			if (_window == NULL || from < _window || from >= _window + structural::BLOCK_SIZE) {
+				// Index the window starting at 'from'
+				const size_t available = std::min<size_t>(_end - from, structural::BLOCK_SIZE);
+				const structural::masks masks = structural::classify(from, available, _dialect.separator(), _dialect.quote());
+				_window = from;
+				_windowMasks[Quotes] = masks.quote;
+				_windowMasks[Special] = masks.all();
+				_windowMasks[LineEndings] = masks.eol();
+			}
+
+			const uint64_t bits = _windowMasks[mask] >> (from - _window);
+			if (bits != 0) {
+				return from + structural::trailing_zeros(bits);
+			}
+
+			if (static_cast<size_t>(_end - _window) <= structural::BLOCK_SIZE) {
+				break;
+			}
+			from = _window + structural::BLOCK_SIZE;
+		}
+		return _end;
+	}
+
+	template <typename Dialect>
+	void basic_scanner<Dialect>::finish() {
+		_finished = true;
+	}
+
+	template <typename Dialect>
+	void basic_scanner<Dialect>::stop() {
+		_state = Done;
+		_lineEnded = true;
+	}
+
+	template <typename Dialect>
+	void basic_scanner<Dialect>::startField() {
+		if (_column == _view.content.size()) {
+			_view.content.emplace_back();
+			_record.content.emplace_back();
+			_offsets.push_back(NOT_STORED);
+		}
+
+		csv::field_view& view = _view.content[_column];
+		view.row = _row;
+		view.column = _column;
+		view.data = NULL;
+		view.size = 0;
+		view.raw = NULL;
+		view.rawSize = 0;
+		_offsets[_column] = NOT_STORED;
+
+		if (materialize) {
+			csv::field& field = _record.content[_column];
+			field.row = _row;
+			field.column = _column;
+			field.content.clear();
+		}
+
+		_span = NULL;
+		_pending.clear();
+		_raw = NULL;
+		_quoted = false;
+		_escaped = false;
+		// A field that is tested is built, even if it isn't included in the projection
+		_tested = !_rejected && filter.tests(_column) && filter.applies(_row);
+		_skip = _rejected || (!_tested && !columns.includes(_column));
+	}
+
+	template <typename Dialect>
+	bool basic_scanner<Dialect>::endField() {
+		csv::field_view& view = _view.content[_column];
+		if (_pending.empty()) {
+			// The field refers directly to the data
+			view.data = _span;
+			view.size = (_span != NULL) ? (_spanEnd - _span) : 0;
+		}
+		else {
+			if (_span != NULL) {
+				_pending.append(_span, _spanEnd - _span);
+			}
+			_offsets[_column] = _storage.size();
+			_storage.append(_pending);
+			view.data = _storage.data() + _offsets[_column];
+			view.size = _pending.size();
+			_pending.clear();
+		}
+		_span = NULL;
+
+		if (_tested) {
+			if (!filter.matches(_column, view.data, view.size)) {
+				// Skip the rest of the record
+				_rejected = true;
+			}
+			if (!columns.includes(_column)) {
+				_skipped = _skipped || (view.size > 0);
+				view.data = NULL;
+				view.size = 0;
+				_skip = true;
+			}
+		}
+
+		view.quoted = _quoted;
+		view.escaped = _escaped;
+		if (_raw != NULL && !_escaped && !_skip && _offsets[_column] == NOT_STORED) {
+			// The field's text is still within the current block
+			view.raw = _raw;
+			view.rawSize = view.size + (_quoted ? 2 : 0);
+		}
+
+		if (materialize) {
+			_record.content[_column].content.assign(view.data, view.size);
+		}
+
+		_column++;
+		return reportFields && !_rejected;
+	}
+
+	template <typename Dialect>
+	void basic_scanner<Dialect>::detach() {
+		// The current block is about to be replaced.  Copy the field in progress (which always has to be
+		// copied eventually) along with any completed fields of the record that refer to the block
+		if (_span != NULL) {
+			_pending.append(_span, _spanEnd - _span);
+			_span = NULL;
+		}
+		_raw = NULL;
+
+		for (size_t column = 0; column < _column; column++) {
+			csv::field_view& view = _view.content[column];
+			if (_offsets[column] == NOT_STORED && view.size > 0) {
+				_offsets[column] = _storage.size();
+				_storage.append(view.data, view.size);
+			}
+			view.raw = NULL;
+			view.rawSize = 0;
+		}
+	}
+
+	template <typename Dialect>
+	bool basic_scanner<Dialect>::endLine() {
+		// Line endings are only ever '\r', '\n' or '\r\n'.  A '\n' following a '\r' is consumed
+		// when the next record starts
+		_pendingCR = (*_cursor == '\r');
+		++_cursor;
+		_state = RecordStart;
+		_lineEnded = true;
+		return endField();
+	}
+
+	template <typename Dialect>
+	bool basic_scanner<Dialect>::completeRecord() {
+		_record.row = _row;
+		_record.content.resize(_column);
+		_view.row = _row;
+		_view.content.resize(_column);
+		_offsets.resize(_column);
+
+		// The storage is complete, so the copied fields can now refer to it
+		for (size_t column = 0; column < _column; column++) {
+			if (_offsets[column] != NOT_STORED) {
+				_view.content[column].data = _storage.data() + _offsets[column];
+			}
+		}
+		// Fields missing from the end of a short record are tested as empty
+		_rejected = _rejected || (filter.applies(_row) && !filter.matches_missing(_column));
+		_column = 0;
+
+		// A record is only blank if its skipped fields are empty too.  Records that fail the filter keep their row
+		if (!_dialect.skipBlankLines() || _skipped || !_view.empty()) {
+			_row++;
+			if (!_rejected) {
+				_recordComplete = true;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template <typename Dialect>
+	void basic_scanner<Dialect>::startFieldContent(char ch) {
+		// The start of a field's content, after any comment or leading whitespace has been handled.
+		_raw = _cursor;
+		if (ch == _dialect.quote()) {
+			++_cursor;
+			_quoted = true;
+			_state = Quoted;
+		}
+		else {
+			_state = Unquoted;
+		}
+	}
+
+	template <typename Dialect>
+	typename basic_scanner<Dialect>::Event basic_scanner<Dialect>::next() {
+		if (_recordComplete) {
+			// The previous call reported a record.  Start afresh
+			_recordComplete = false;
+		}
+
+		while (true) {
+
+			if (_lineEnded) {
+				_lineEnded = false;
+				if (completeRecord()) {
+					return Record;
+				}
+			}
+
+			if (_cursor == _end) {
+				if (!_finished) {
+					detach();
+					return NeedData;
+				}
+
+				// At the end of the data.  Complete any field and record in progress
+				switch (_state) {
+					case Done:
+					case RecordStart:
+						_state = Done;
+						return Finished;
+					case FieldStart:
+						// A separator was the last character, meaning an empty field finishes the data.
+						endField();
+						_state = Done;
+						_lineEnded = true;
+						continue;
+					case Whitespace:
+						// The last of the whitespace remains part of the field
+						_span = NULL;
+						_pending.clear();
+						append(' ');
+						_escaped = true;
+						break;
+					case Quoted:
+						// The closing quote is missing
+						_escaped = true;
+						break;
+					default:
+						break;
+				}
+				_state = Done;
+				_lineEnded = true;
+				if (endField()) {
+					return Field;
+				}
+				continue;
+			}
+
+			switch (_state) {
+				case RecordStart: {
+					if (_pendingCR) {
+						_pendingCR = false;
+						if (*_cursor == '\n') {
+							++_cursor;
+							continue;
+						}
+					}
+					_firstField = true;
+					_skipped = false;
+					_rejected = false;
+					_storage.clear();
+					startField();
+					_state = FieldStart;
+					break;
+				}
+
+				case FieldStart: {
+					const char ch = *_cursor;
+					if (_firstField && _dialect.comment() != '\0' && ch == _dialect.comment()) {
+						// Only single line comments at the start of a record are supported
+						++_cursor;
+						_state = Comment;
+					}
+					else if (_dialect.trimLeadingWhitespace() && ch == ' ') {
+						++_cursor;
+						_state = Whitespace;
+					}
+					else if (ch == '\r' || ch == '\n') {
+						if (endLine()) {
+							return Field;
+						}
+					}
+					else {
+						startFieldContent(ch);
+					}
+					break;
+				}
+
+				case Whitespace: {
+					while (_cursor < _end && *_cursor == ' ') {
+						++_cursor;
+					}
+					if (_cursor == _end) {
+						break;
+					}
+					const char ch = *_cursor;
+					if (ch == '\r' || ch == '\n') {
+						if (endLine()) {
+							return Field;
+						}
+					}
+					else {
+						startFieldContent(ch);
+					}
+					break;
+				}
+
+				case Unquoted: {
+					// Locate the end of the run of plain text
+					const char* start = _cursor;
+					_cursor = find(_cursor, Special);
+					append(start, _cursor);
+					if (_cursor == _end) {
+						break;
+					}
+
+					const char ch = *_cursor;
+					if (ch == _dialect.separator()) {
+						++_cursor;
+						_firstField = false;
+						_state = FieldStart;
+						const bool report = endField();
+						startField();
+						if (report) {
+							return Field;
+						}
+					}
+					else if (ch == '\r' || ch == '\n') {
+						if (endLine()) {
+							return Field;
+						}
+					}
+					else {
+						// A quote within an unquoted field
+						++_cursor;
+						_state = UnquotedQuote;
+					}
+					break;
+				}
+
+				case UnquotedQuote: {
+					// A double quote within an unquoted field is treated as a single quote.  A lone quote is
+					// bad, but recover by assuming it was meant to be a single quote character.
+					_escaped = true;
+					if (_cursor > _begin) {
+						append(_cursor - 1, _cursor);
+					}
+					else {
+						// The quote was at the end of the previous block
+						append(_dialect.quote());
+					}
+					if (*_cursor == _dialect.quote()) {
+						++_cursor;
+					}
+					_state = Unquoted;
+					break;
+				}
+
+				case Quoted: {
+					const char* quote = find(_cursor, Quotes);
+					if (quote == _end) {
+						append(_cursor, _end);
+						_cursor = _end;
+					}
+					else {
+						append(_cursor, quote);
+						_cursor = quote + 1;
+						_state = QuotedQuote;
+					}
+					break;
+				}
+
+				case QuotedQuote: {
+					if (*_cursor == _dialect.quote()) {
+						// 2DQUOTE -- push the (second) quote into the field.
+						_escaped = true;
+						append(_cursor, _cursor + 1);
+						++_cursor;
+						_state = Quoted;
+					}
+					else {
+						_state = AfterQuoted;
+					}
+					break;
+				}
+
+				case AfterQuoted: {
+					// Following the end of a quoted field, skip to the next separator or end of line
+					while (_cursor < _end) {
+						const char ch = *_cursor;
+						if (ch == '\r' || ch == '\n') {
+							if (endLine()) {
+								return Field;
+							}
+							break;
+						}
+						if (ch == _dialect.separator()) {
+							++_cursor;
+							_firstField = false;
+							_state = FieldStart;
+							const bool report = endField();
+							startField();
+							if (report) {
+								return Field;
+							}
+							break;
+						}
+						// Text following the closing quote is ignored
+						_escaped = true;
+						++_cursor;
+					}
+					break;
+				}
+
+				case Comment: {
+					_cursor = find(_cursor, LineEndings);
+					if (_cursor < _end && endLine()) {
+						return Field;
+					}
+					break;
+				}
+
+				case Done:
+					return Finished;
+			}
+		}
+	}
+
+/// A scanner configured at runtime
+typedef basic_scanner<runtime_dialect> scanner;
+
+extern template class basic_scanner<runtime_dialect>;
+};
@@ -0,0 +1,195 @@
+//
+//  structural.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+#pragma once
+
+// Structural indexing of CSV data.
+//
+// Blocks of 64 bytes are classified into bitmasks (bit n representing byte n) for the quote, separator, carriage
+// return and line feed characters.  The classification is vectorized where the compiler targets a supported
+// instruction set (AVX2 or SSE2 on x86, NEON on ARM) with a scalar fallback otherwise.
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+	#include <immintrin.h>
+	#define CSV_STRUCTURAL_AVX2 1
+#elif defined(__SSE2__)
+	#include <emmintrin.h>
+	#define CSV_STRUCTURAL_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	#include <arm_neon.h>
+	#define CSV_STRUCTURAL_NEON 1
+#endif
+
+namespace csv {
+namespace structural {
+
+	/// The number of bytes classified at a time
+	static const size_t BLOCK_SIZE = 64;
+
+	/// Bitmasks for the structural characters within a block of 64 bytes
+	struct masks {
+		uint64_t quote = 0;
+		uint64_t separator = 0;
+		uint64_t cr = 0;
+		uint64_t lf = 0;
+
+		/// All of the structural characters
+		inline uint64_t all() const { return quote | separator | cr | lf; }
+		/// Line endings
+		inline uint64_t eol() const { return cr | lf; }
+	};
+
+	/// Returns the index of the lowest set bit.  bits must be non-zero
+	inline unsigned trailing_zeros(uint64_t bits) {
+		return static_cast<unsigned>(__builtin_ctzll(bits));
+	}
+
+	/// Returns the number of bits set
+	inline unsigned count(uint64_t bits) {
+		return static_cast<unsigned>(__builtin_popcountll(bits));
+	}
+
+#if defined(CSV_STRUCTURAL_AVX2)
+
+	inline uint64_t match(const __m256i& lo, const __m256i& hi, char ch) {
+		const __m256i value = _mm256_set1_epi8(ch);
+		const uint64_t l = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, value)));
+		const uint64_t h = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, value)));
+		return l | (h << 32);
+	}
+
+	/// Classify the 64 bytes starting at data, using the given separator and quote characters
+	inline masks classify_block(const char* data, char separator, char quote) {
+		const __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+		const __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + 32));
+		masks result;
+		result.quote = match(lo, hi, quote);
+		result.separator = match(lo, hi, separator);
+		result.cr = match(lo, hi, '\r');
+		result.lf = match(lo, hi, '\n');
+		return result;
+	}
+
+#elif defined(CSV_STRUCTURAL_SSE2)
+
+	inline uint64_t match(const __m128i (&chunks)[4], char ch) {
+		const __m128i value = _mm_set1_epi8(ch);
+		uint64_t result = 0;
+		for (int index = 0; index < 4; index++) {
+			const uint64_t bits = static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunks[index], value)));
+			result |= bits << (index * 16);
+		}
+		return result;
+	}
+
+	/// Classify the 64 bytes starting at data, using the given separator and quote characters
+	inline masks classify_block(const char* data, char separator, char quote) {
+		const __m128i chunks[4] = {
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 32)),
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 48))
+		};
+		masks result;
+		result.quote = match(chunks, quote);
+		result.separator = match(chunks, separator);
+		result.cr = match(chunks, '\r');
+		result.lf = match(chunks, '\n');
+		return result;
+	}
+
+#elif defined(CSV_STRUCTURAL_NEON)
+
+	inline uint64_t match(const uint8x16_t (&chunks)[4], char ch) {
+		// Reduce the four comparison results to a 64 bit mask (one bit per byte)
+		static const uint8_t bit_values[16] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80,
+												0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80 };
+		const uint8x16_t bits = vld1q_u8(bit_values);
+		const uint8x16_t value = vdupq_n_u8(static_cast<uint8_t>(ch));
+		uint8x16_t m0 = vandq_u8(vceqq_u8(chunks[0], value), bits);
+		uint8x16_t m1 = vandq_u8(vceqq_u8(chunks[1], value), bits);
+		uint8x16_t m2 = vandq_u8(vceqq_u8(chunks[2], value), bits);
+		uint8x16_t m3 = vandq_u8(vceqq_u8(chunks[3], value), bits);
+		uint8x16_t sum0 = vpaddq_u8(m0, m1);
+		uint8x16_t sum1 = vpaddq_u8(m2, m3);
+		sum0 = vpaddq_u8(sum0, sum1);
+		sum0 = vpaddq_u8(sum0, sum0);
+		return vgetq_lane_u64(vreinterpretq_u64_u8(sum0), 0);
+	}
+
+	/// Classify the 64 bytes starting at data, using the given separator and quote characters
+	inline masks classify_block(const char* data, char separator, char quote) {
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+		const uint8x16_t chunks[4] = { vld1q_u8(bytes), vld1q_u8(bytes + 16), vld1q_u8(bytes + 32), vld1q_u8(bytes + 48) };
+		masks result;
+		result.quote = match(chunks, quote);
+		result.separator = match(chunks, separator);
+		result.cr = match(chunks, '\r');
+		result.lf = match(chunks, '\n');
+		return result;
+	}
+
+#else
+
+	/// Classify the 64 bytes starting at data, using the given separator and quote characters
+	inline masks classify_block(const char* data, char separator, char quote) {
+		masks result;
+		for (size_t index = 0; index < BLOCK_SIZE; index++) {
+			const uint64_t bit = uint64_t(1) << index;
+			const char ch = data[index];
+			if (ch == quote) { result.quote |= bit; }
+			if (ch == separator) { result.separator |= bit; }
+			if (ch == '\r') { result.cr |= bit; }
+			if (ch == '\n') { result.lf |= bit; }
+		}
+		return result;
+	}
+
+#endif
+
+	/// Classify the 64 bytes starting at data, using '"' as the quote character
+	inline masks classify(const char* data, char separator) {
+		return classify_block(data, separator, '\"');
+	}
+
+	/// Classify up to 64 bytes.  Bytes beyond 'size' are not reported
+	inline masks classify(const char* data, size_t size, char separator, char quote = '\"') {
+		if (size >= BLOCK_SIZE) {
+			return classify_block(data, separator, quote);
+		}
+
+		char padded[BLOCK_SIZE];
+		memset(padded, 0, BLOCK_SIZE);
+		memcpy(padded, data, size);
+		masks result = classify_block(padded, separator, quote);
+
+		const uint64_t valid = (size == 0) ? 0 : (~uint64_t(0) >> (BLOCK_SIZE - size));
+		result.quote &= valid;
+		result.separator &= valid;
+		result.cr &= valid;
+		result.lf &= valid;
+		return result;
+	}
+};
+};
@@ -0,0 +1,310 @@
+//
+//  writer.hpp
+//
+//  Copyright © 2019 Darren Ford. All rights reserved.
+//
+//  MIT license
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated
+//  documentation files (the "Software"), to deal in the Software without restriction, including without limitation the
+//  rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to
+//  permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in all copies or substantial
+//  portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+//  WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS
+//  OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+//  OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+
+
+#pragma once
+
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <csv/parser.hpp>
+#include <csv/scanner.hpp>
+#include <csv/structural.hpp>
+
+namespace csv {
+
+/// Writes UTF-8 CSV/TSV data to a file descriptor, stream or string.
+///
+/// The output is collected in a large buffer and only handed to the file descriptor (or stream) when the buffer
+/// fills, so writing a field is usually just a copy.  Each field is scanned a block at a time for the quote,
+/// separator and line ending characters using the structural classification (see structural.hpp).  Fields that
+/// don't contain any of them are copied as is, the rest are quoted with their quotes doubled.  Fields that would
+/// otherwise be changed by the parser (a leading space when whitespace is trimmed, or a leading comment character)
+/// are also quoted, so the output parses back to the same records using the same dialect.
+///
+/// The Dialect provides the separator and quote characters (along with the whitespace and comment rules), as for
+/// the scanner.
+template <typename Dialect>
+class basic_writer {
+public:
+	/// The default size of the output buffer
+	static const size_t DEFAULT_BUFFER_SIZE = 1024 * 1024;
+
+	/// Write to a file descriptor.  The descriptor isn't closed by the writer
+	basic_writer(int fd, const Dialect& dialect = Dialect(), size_t bufferSize = DEFAULT_BUFFER_SIZE)
+		: _dialect(dialect)
+		, _fd(fd)
+		, _buffer(std::max<size_t>(bufferSize, structural::BLOCK_SIZE)) {
+	}
+
+	/// Write to a stream
+	basic_writer(std::ostream& stream, const Dialect& dialect = Dialect(), size_t bufferSize = DEFAULT_BUFFER_SIZE)
+		: _dialect(dialect)
+		, _stream(&stream)
+		, _buffer(std::max<size_t>(bufferSize, structural::BLOCK_SIZE)) {
+	}
+
+	/// Append to a string.  The output is appended directly (without a buffer), so a writer can cheaply be created
+	/// for each record
+	basic_writer(std::string& output, const Dialect& dialect = Dialect())
+		: _dialect(dialect)
+		, _string(&output) {
+	}
+
+	~basic_writer() {
+		flush();
+	}
+
+	basic_writer(const basic_writer&) = delete;
+	basic_writer& operator=(const basic_writer&) = delete;
+
+	/// Quote every field, rather than only the fields that need it
+	bool quoteAll = false;
+
+	/// The characters written at the end of each record
+	std::string lineEnding = "\n";
+
+	/// Write the next field of the current record
+	void write_field(const char* data, size_t size);
+	inline void write_field(const std::string& field) { write_field(field.data(), field.size()); }
+	inline void write_field(const csv::field& field) { write_field(field.content); }
+	inline void write_field(const csv::field_view& field) { write_field(field.data, field.size); }
+
+	/// Write the next field of the current record as is, without checking whether it needs to be quoted.  The field
+	/// must already be suitable for the dialect -- either free of quotes, separators and line endings, or quoted
+	/// with its quotes doubled (for example the raw text of a field parsed with the same dialect)
+	inline void write_raw(const char* data, size_t size) {
+		if (_column > 0) {
+			append(_dialect.separator());
+		}
+		append(data, size);
+		_column++;
+		_emptyField = (size == 0);
+	}
+
+	/// Complete the current record
+	void end_record();
+
+	/// Write data that is already formatted as complete records for the dialect (for example, the output of
+	/// another writer).  Data larger than the buffer is written in a single call
+	inline void write_records(const char* data, size_t size) {
+		append(data, size);
+	}
+
+	/// Write all of the fields of a record, completing it
+	template <typename Record>
+	void write_record(const Record& record) {
+		for (const auto& field: record.content) {
+			write_field(field);
+		}
+		end_record();
+	}
+
+	/// Does the field need to be quoted?
+	bool needs_quotes(const char* data, size_t size) const;
+
+	/// Write the buffered output.  Returns false if the output couldn't be written
+	bool flush();
+
+	/// Has writing the output failed?
+	inline bool failed() const { return _failed; }
+
+	/// The number of bytes written so far (including the buffered output)
+	inline size_t position() const { return _written + _size; }
+
+private:
+	/// Append to the buffer, writing the buffer (or the data directly) when it's full
+	inline void append(const char* data, size_t size) {
+		if (_string != NULL) {
+			_string->append(data, size);
+			_written += size;
+			return;
+		}
+		if (size > _buffer.size() - _size) {
+			flush();
+			if (size >= _buffer.size()) {
+				output(data, size);
+				return;
+			}
+		}
+		memcpy(_buffer.data() + _size, data, size);
+		_size += size;
+	}
+
+	inline void append(char ch) {
+		if (_string != NULL) {
+			_string->push_back(ch);
+			_written++;
+			return;
+		}
+		if (_size == _buffer.size()) {
+			flush();
+		}
+		_buffer[_size++] = ch;
+	}
+
+	/// Append a quoted field, doubling the quotes within it
+	void append_quoted(const char* data, size_t size);
+
+	/// Write data to the file descriptor or stream
+	bool output(const char* data, size_t size);
+
+	const Dialect _dialect;
+	int _fd = -1;
+	std::ostream* _stream = NULL;
+	std::string* _string = NULL;
+
+	std::vector<char> _buffer;
+	size_t _size = 0;
+	size_t _written = 0;
+	bool _failed = false;
+
+	// The number of fields written to the current record, and whether the last one was empty
+	size_t _column = 0;
+	bool _emptyField = false;
+};
+
+template <typename Dialect>
+bool basic_writer<Dialect>::needs_quotes(const char* data, size_t size) const {
+	if (size == 0) {
+		return false;
+	}
+	if ((_dialect.trimLeadingWhitespace() && data[0] == ' ') ||
+		(_column == 0 && _dialect.comment() != '\0' && data[0] == _dialect.comment())) {
+		return true;
+	}
+
+	const char separator = _dialect.separator();
+	const char quote = _dialect.quote();
+	while (size >= structural::BLOCK_SIZE) {
+		if (structural::classify_block(data, separator, quote).all() != 0) {
+			return true;
+		}
+		data += structural::BLOCK_SIZE;
+		size -= structural::BLOCK_SIZE;
+	}
+	return size > 0 && structural::classify(data, size, separator, quote).all() != 0;
+}
+
+template <typename Dialect>
+void basic_writer<Dialect>::write_field(const char* data, size_t size) {
+	if (_column > 0) {
+		append(_dialect.separator());
+	}
+	if (quoteAll || needs_quotes(data, size)) {
+		append_quoted(data, size);
+	}
+	else {
+		append(data, size);
+	}
+	_column++;
+	_emptyField = (size == 0);
+}
+
+template <typename Dialect>
+void basic_writer<Dialect>::append_quoted(const char* data, size_t size) {
+	const char quote = _dialect.quote();
+	append(quote);
+
+	// Copy the runs between the quotes, doubling each quote
+	while (size > 0) {
+		const size_t length = std::min(size, structural::BLOCK_SIZE);
+		uint64_t quotes = structural::classify(data, length, _dialect.separator(), quote).quote;
+		size_t start = 0;
+		while (quotes != 0) {
+			const size_t end = structural::trailing_zeros(quotes) + 1;
+			append(data + start, end - start);
+			append(quote);
+			start = end;
+			quotes &= quotes - 1;
+		}
+		append(data + start, length - start);
+		data += length;
+		size -= length;
+	}
+
+	append(quote);
+}
+
+template <typename Dialect>
+void basic_writer<Dialect>::end_record() {
+	if (_column == 1 && _emptyField) {
+		// A record with a single empty field would otherwise be a blank line
+		append(_dialect.quote());
+		append(_dialect.quote());
+	}
+	append(lineEnding.data(), lineEnding.size());
+	_column = 0;
+	_emptyField = false;
+}
+
+template <typename Dialect>
+bool basic_writer<Dialect>::flush() {
+	if (_size > 0) {
+		output(_buffer.data(), _size);
+		_size = 0;
+	}
+	if (_stream != NULL && !_failed) {
+		_stream->flush();
+		_failed = !(*_stream);
+	}
+	return !_failed;
+}
+
+template <typename Dialect>
+bool basic_writer<Dialect>::output(const char* data, size_t size) {
+	_written += size;
+	if (_failed) {
+		return false;
+	}
+
+	if (_stream != NULL) {
+		_stream->write(data, static_cast<std::streamsize>(size));
+		_failed = !(*_stream);
+		return !_failed;
+	}
+
+	while (size > 0) {
+		const ssize_t count = ::write(_fd, data, size);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			_failed = true;
+			return false;
+		}
+		data += count;
+		size -= static_cast<size_t>(count);
+	}
+	return true;
+}
+
+/// A writer configured at runtime
+typedef basic_writer<runtime_dialect> writer;
+
+extern template class basic_writer<runtime_dialect>;
+};
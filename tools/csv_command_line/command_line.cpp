@@ -29,6 +29,12 @@ bool handle_command_args(int argc, const char * const * argv, Arguments& args) {
 		cmd.add( verboseArg );
 		TCLAP::ValueArg<size_t> limitArg("l", "limit", "limit to the first <limit> records", false, 0, "limit");
 		cmd.add( limitArg );
+		TCLAP::ValueArg<size_t> threadsArg("j", "threads", "Convert using <threads> threads (0 for one per core)", false, 1, "threads");
+		cmd.add( threadsArg );
+		TCLAP::ValueArg<std::string> columnsArg("k", "columns", "Only output these columns, in this order (numbers starting at 1, or names from the header)", false, "", "columns");
+		cmd.add( columnsArg );
+		TCLAP::MultiArg<std::string> whereArg("w", "where", "Only output records where <column><op><value> holds. <op> is one of = != ^= (starts with) *= (contains) < <= > >=. If any column is named, the header is always output", false, "condition");
+		cmd.add( whereArg );
 		TCLAP::UnlabeledValueArg<std::string> fileArg("file", "input file", true, "filenameString", "value");
 		cmd.add( fileArg );
 		
@@ -39,6 +45,9 @@ bool handle_command_args(int argc, const char * const * argv, Arguments& args) {
 		args.verbose = verboseArg.getValue();
 		args.inputFile = fileArg.getValue();
 		args.limit = limitArg.getValue();
+		args.threads = threadsArg.getValue();
+		args.columns = columnsArg.getValue();
+		args.where = whereArg.getValue();
 		args.codepage = codepageArg.getValue();
 		args.separator = separatorArg.getValue();
 	}
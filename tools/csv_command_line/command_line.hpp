@@ -9,6 +9,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 struct Arguments {
 	std::string type;
@@ -17,6 +18,9 @@ struct Arguments {
 	std::string inputFile;
 	std::string codepage;
 	size_t limit;
+	size_t threads;
+	std::string columns;
+	std::vector<std::string> where;
 };
 
 bool handle_command_args(int argc, const char * const * argv, Arguments& args);
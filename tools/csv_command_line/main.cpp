@@ -1,8 +1,15 @@
 
 #include <iostream>
 #include <algorithm>
+#include <deque>
 #include <csv/parser.hpp>
+#include <csv/pipeline.hpp>
+#include <csv/parallel.hpp>
+#include <csv/dialect.hpp>
+#include <csv/writer.hpp>
+#include <csv/filter.hpp>
 #include <csv/datasource/icu/DataSource.hpp>
+#include <csv/datasource/icu/Encoding.hpp>
 
 #include "command_line.hpp"
 
@@ -20,14 +27,240 @@ namespace {
 		fflush (stderr);
 	}
 
-	void ReplaceStringInPlace(std::string& subject,
-							  const std::string& search,
-							  const std::string& replace) {
-		size_t pos = 0;
-		while ((pos = subject.find(search, pos)) != std::string::npos) {
-			subject.replace(pos, search.length(), replace);
-			pos += replace.length();
+	typedef csv::basic_writer<csv::tab_separated> tsv_writer;
+
+	/// Write a record as TSV.  Fields are only quoted (with their quotes doubled) when they contain a quote, tab or
+	/// line ending.  The raw text of a field is copied straight from the input if it is already valid TSV.  For TSV
+	/// input that's any field that wasn't escaped.  Otherwise it's an unquoted field without a tab, as it can't
+	/// contain quotes or line endings.
+	///
+	/// If 'columns' isn't empty, only those columns are written, in that order.
+	void WriteRecord(tsv_writer& output, const csv::record_view& record, bool tsvInput, const std::vector<size_t>& columns) {
+		auto writeField = [&output, tsvInput](const csv::field_view& field) {
+			if (field.raw != NULL && (tsvInput || (!field.quoted && memchr(field.raw, '\t', field.rawSize) == NULL))) {
+				output.write_raw(field.raw, field.rawSize);
+			}
+			else {
+				output.write_field(field);
+			}
+		};
+
+		if (columns.empty()) {
+			for (const auto& field : record.content) {
+				writeField(field);
+			}
+		}
+		else {
+			for (const size_t column : columns) {
+				if (column < record.size()) {
+					writeField(record[column]);
+				}
+				else {
+					output.write_raw("", 0);
+				}
+			}
+		}
+		output.end_record();
+	}
+
+	/// A data source that keeps the blocks it reads from another source until rewind() is called, and then returns
+	/// them again before the rest of the source.  The header can then be read from a pipe whose records are converted
+	/// afterwards.  The last block read is only copied if another block is read before rewind() (a block is valid
+	/// until the next is read), so reading the header of a mapped file doesn't copy it
+	class RewindableDataSource final: public csv::utf8::DataSource {
+	public:
+		explicit RewindableDataSource(std::unique_ptr<csv::utf8::DataSource> source)
+			: _source(std::move(source)) {
+			// The blocks are validated as they're parsed from this source rather than the original
+			validate = _source->validate;
+		}
+
+		/// Return the blocks read so far again, and stop keeping them
+		void rewind() {
+			_keeping = false;
+			reset();
+		}
+
+	public:
+		virtual csv::block read_block() {
+			if (!_keeping) {
+				if (!_kept.empty()) {
+					// The block returned is kept until the next is read
+					_replayed = std::move(_kept.front().first);
+					const bool eof = _kept.front().second;
+					_kept.pop_front();
+					return csv::block(_replayed.data(), _replayed.size(), eof);
+				}
+				if (_hasLast) {
+					_hasLast = false;
+					return _last;
+				}
+				return _source->read_block();
+			}
+
+			if (_hasLast) {
+				_kept.emplace_back(std::string(_last.data, _last.size), _last.eof);
+			}
+			_last = _source->read_block();
+			_hasLast = true;
+			return _last;
+		}
+		virtual double progress_at(size_t position) const {
+			return _source->progress_at(position);
+		}
+
+	private:
+		std::unique_ptr<csv::utf8::DataSource> _source;
+		bool _keeping = true;
+		// The blocks read before the last (copied), and the last block read (which is still valid)
+		std::deque<std::pair<std::string, bool>> _kept;
+		std::string _replayed;
+		csv::block _last;
+		bool _hasLast = false;
+	};
+
+	/// The file (or pipe) to convert.  It's opened when it's first needed, and the header is read from the same
+	/// source as the records, so that a pipe is only read once
+	struct Input {
+		std::string path;
+		std::string codepage;
+		char separator = ',';
+
+		std::unique_ptr<RewindableDataSource> source;
+		/// The names of the columns, once the header has been read
+		std::vector<std::string> names;
+
+		/// Open the file.  UTF-8 (and plain ASCII) files are parsed directly, other files are converted to UTF-8
+		/// as they are read
+		bool open() {
+			if (source) {
+				return true;
+			}
+			std::unique_ptr<csv::utf8::DataSource> input = csv::icu::open_file(path.c_str(), codepage.length() > 0 ? codepage.c_str() : NULL);
+			if (!input) {
+				return false;
+			}
+			source.reset(new RewindableDataSource(std::move(input)));
+			source->separator = separator;
+			return true;
+		}
+
+		/// Read the names of the columns from the first record of the file
+		bool read_header() {
+			if (!names.empty()) {
+				return true;
+			}
+			if (!open()) {
+				return false;
+			}
+
+			csv::parse(*source, [this](const csv::record_view& record, double) -> bool {
+				for (const auto& field : record.content) {
+					names.push_back(field.str());
+				}
+				return false;
+			});
+			source->rewind();
+			return !names.empty();
+		}
+	};
+
+	/// Convert a column number (starting at 1) or a name from the header to a column index.  The header is only read
+	/// the first time a name is used.
+	bool ResolveColumn(Input& input, const std::string& name, size_t& column) {
+		if (!name.empty() && name.find_first_not_of("0123456789") == std::string::npos) {
+			column = strtoul(name.c_str(), NULL, 10);
+			if (column == 0) {
+				cerr << "Column numbers start at 1" << endl;
+				return false;
+			}
+			column -= 1;
+			return true;
+		}
+
+		if (!input.read_header()) {
+			cerr << "Unable to read the header" << endl;
+			return false;
+		}
+		const auto found = std::find(input.names.begin(), input.names.end(), name);
+		if (found == input.names.end()) {
+			cerr << "Unknown column '" << name << "'" << endl;
+			return false;
+		}
+		column = found - input.names.begin();
+		return true;
+	}
+
+	/// Convert the --columns list (column numbers starting at 1, or names from the header) to column indexes
+	bool ResolveColumns(const Arguments& args, Input& input, std::vector<size_t>& columns) {
+		size_t start = 0;
+		while (start <= args.columns.length()) {
+			size_t end = args.columns.find(',', start);
+			if (end == std::string::npos) {
+				end = args.columns.length();
+			}
+			const std::string name = args.columns.substr(start, end - start);
+			start = end + 1;
+
+			size_t column = 0;
+			if (!ResolveColumn(input, name, column)) {
+				return false;
+			}
+			columns.push_back(column);
 		}
+		return true;
+	}
+
+	/// Convert the --where conditions to a filter.  Each condition is a column (number or name, as for --columns),
+	/// an operator and the value to compare against, eg. 'price>=10' or 'city^=San'
+	bool ResolveFilter(const Arguments& args, Input& input, csv::filter& filter) {
+		static const struct {
+			const char* text;
+			csv::predicate::Test test;
+		} operators[] = {
+			// Two character operators first, so '<=' isn't read as '<' followed by '='
+			{ "!=", csv::predicate::NotEquals },
+			{ "^=", csv::predicate::Prefix },
+			{ "*=", csv::predicate::Contains },
+			{ "<=", csv::predicate::LessOrEqual },
+			{ ">=", csv::predicate::GreaterOrEqual },
+			{ "=", csv::predicate::Equals },
+			{ "<", csv::predicate::Less },
+			{ ">", csv::predicate::Greater },
+		};
+
+		for (const auto& condition : args.where) {
+			const size_t position = condition.find_first_of("!^*<>=");
+			if (position == std::string::npos || position == 0) {
+				cerr << "Invalid condition '" << condition << "'" << endl;
+				return false;
+			}
+
+			bool found = false;
+			for (const auto& op : operators) {
+				const size_t length = strlen(op.text);
+				if (condition.compare(position, length, op.text) != 0) {
+					continue;
+				}
+
+				size_t column = 0;
+				if (!ResolveColumn(input, condition.substr(0, position), column)) {
+					return false;
+				}
+				if (!filter.add(column, op.test, condition.substr(position + length))) {
+					cerr << "Invalid number in condition '" << condition << "'" << endl;
+					return false;
+				}
+				found = true;
+				break;
+			}
+
+			if (!found) {
+				cerr << "Invalid condition '" << condition << "'" << endl;
+				return false;
+			}
+		}
+		return true;
 	}
 };
 
@@ -40,62 +273,149 @@ int main(int argc, const char * argv[]) {
 		return -1;
 	}
 
-	csv::icu::FileDataSource input;
-	if (!input.open(args.inputFile.c_str(), args.codepage.length() > 0 ? args.codepage.c_str() : NULL)) {
-		cerr << "Unable to open file" << endl;
-		exit(-1);
-	}
-
+	char separator = ',';
 	if (args.type == "tsv") {
-		input.separator = '\t';
+		separator = '\t';
 	}
 
 	if (args.separator != ',') {
-		input.separator = args.separator;
+		separator = args.separator;
 	}
 
+	const bool tsvInput = (separator == '\t');
+
 	int pp = -1;
-	int total = 0;
+	size_t total = 0;
 
 	bool verbose = args.verbose;
 	size_t limit = args.limit;
 
-	auto recordAdder = [&pp, verbose, limit, &total](const csv::record& record, double complete) -> bool {
+	tsv_writer output(STDOUT_FILENO);
 
-		if (total > 0) {
-			cout << "\n";
-		}
+	std::string codepage = args.codepage;
+	bool converted = false;
 
-		total += 1;
-		if (verbose && (int)(complete*100) != pp) {
-			pp = (int)(complete*100);
-			PrintProgress(complete, record.row);
-		}
+	Input input;
+	input.path = args.inputFile;
+	input.codepage = codepage;
+	input.separator = separator;
+
+	// Only the selected columns are built by the parser
+	std::vector<size_t> columns;
+	if (!args.columns.empty() && !ResolveColumns(args, input, columns)) {
+		exit(-1);
+	}
+	const csv::projection projection(columns);
+
+	// Records are dropped by the parser as soon as one of their fields fails a condition
+	csv::filter filter;
+	if (!ResolveFilter(args, input, filter)) {
+		exit(-1);
+	}
+	// If columns are named the file has a header, which is always written.  Otherwise the first record is filtered
+	// like any other
+	filter.header = !input.names.empty();
 
-		bool lineStarted = false;
-		for (const auto& field : record.content) {
-			if (lineStarted) {
-				lineStarted = true;
-				cout << "\t";
+	if (args.threads != 1) {
+		// Split the file into chunks that are converted to TSV by a pool of threads, and write the output of each
+		// chunk in order as a single write.  Only files can be split -- a pipe is converted on a single thread below,
+		// so it isn't sampled here
+		csv::utf8::FileDataSource file;
+		if (file.open(args.inputFile.c_str()) && file.has_length()) {
+			if (codepage.empty()) {
+				const auto detected = csv::icu::encoding::TextEncodingForFile(args.inputFile.c_str());
+				if (detected.invalid()) {
+					cerr << "Unable to open file" << endl;
+					exit(-1);
+				}
+				codepage = detected.name;
 			}
-			std::string fieldValue = field.content;
-			ReplaceStringInPlace(fieldValue, "\"", "\"\"");
-			cout << "\"" << fieldValue << "\"\t";
-		}
 
-		if (limit > 0 && record.row == limit - 1) {
-			PrintProgress(1.0, record.row + 1);
-			return false;
+			file.separator = separator;
+			file.columns = projection;
+			file.filter = filter;
+			// As on a single thread (see csv::icu::open_file), invalid UTF-8 is replaced with U+FFFD
+			file.validate = csv::utf8::validation::Replace;
+
+			csv::parallel_options options;
+			options.threads = args.threads;
+			options.encoding = codepage.c_str();
+
+			auto convert = [tsvInput, &columns](const csv::record_view& record, std::string& chunk) {
+				tsv_writer writer(chunk);
+				WriteRecord(writer, record, tsvInput, columns);
+			};
+
+			auto chunkWriter = [&pp, verbose, limit, &total, &output, &converted](const csv::converted_chunk& chunk, double complete) -> bool {
+				converted = true;
+
+				// Count the records written rather than using the chunk's row, as filtered records leave gaps
+				size_t count = chunk.size();
+				if (limit > 0 && total + count >= limit) {
+					count = limit - total;
+				}
+				output.write_records(chunk.data.data(), (count > 0) ? chunk.ends[count - 1] : 0);
+				total += count;
+
+				if (verbose && (int)(complete*100) != pp) {
+					pp = (int)(complete*100);
+					PrintProgress(complete, total);
+				}
+
+				if (limit > 0 && total == limit) {
+					PrintProgress(1.0, total);
+					return false;
+				}
+
+				return true;
+			};
+
+			// A file that can't be split (eg. in a stateful encoding) fails before any output is written, and is
+			// converted on a single thread below
+			if (csv::parallel_convert(file, convert, chunkWriter, options) == csv::Error && converted) {
+				cerr << "Unable to convert file" << endl;
+				exit(-1);
+			}
 		}
+	}
 
-		// Only flush every 1000 records
-		if ((total % 10000) == 0) {
-			cout << flush;
+	if (!converted) {
+		input.codepage = codepage;
+		if (!input.open()) {
+			cerr << "Unable to open file" << endl;
+			exit(-1);
 		}
+		input.source->columns = projection;
+		input.source->filter = filter;
 
-		return true;
-	};
-	csv::parse(input, NULL, recordAdder);
+		auto recordAdder = [&pp, verbose, limit, &total, &output, tsvInput, &columns](const csv::record_view& record, double complete) -> bool {
+
+			total += 1;
+			if (verbose && (int)(complete*100) != pp) {
+				pp = (int)(complete*100);
+				PrintProgress(complete, total);
+			}
+
+			WriteRecord(output, record, tsvInput, columns);
+
+			if (limit > 0 && total == limit) {
+				PrintProgress(1.0, total);
+				return false;
+			}
+
+			return true;
+		};
+		// Read and decode the file on a background thread, and parse and write the records on this one.  The records
+		// refer to the decoded data rather than copying each field
+		csv::utf8::PipelinedDataSource pipeline(*input.source);
+		csv::parse(pipeline, recordAdder);
+		pipeline.close();
+	}
+
+	if (!output.flush()) {
+		cerr << "Unable to write the output" << endl;
+		exit(-1);
+	}
 
 	if (args.verbose) {
 		PrintProgress(1, total);